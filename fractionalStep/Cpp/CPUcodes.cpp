@@ -0,0 +1,424 @@
+// Sparse and vector kernels used by the CPU version of the solver. They are
+// the CPU counterparts of the kernels in CUDAcodes.cu and are parallelized
+// with openMP.
+
+#include <stdio.h>
+#include <cmath>
+#include <omp.h>
+
+using namespace std;
+
+
+
+
+//========================================================================
+void csrMultiply3(int m, double alpha, double *value, int *col, int *rowStarts,
+                  double *x, int xCompStride, int xNodeStride,
+                  double beta, double *y, int yCompStride, int yNodeStride)
+//========================================================================
+{
+   // Calculates y = alpha * [A] * x + beta * y for three vectors at once, where
+   // [A] is an m x m CSR matrix with 0-based indices. This is used to multiply
+   // [K] with the u, v and w components of a velocity type vector, so that the
+   // values and column indices of [K] are streamed only once instead of three
+   // times.
+
+   // Component c of node i is stored at x[c*xCompStride + i*xNodeStride].
+   //   Blocked    [u | v | w] layout : xCompStride = NN, xNodeStride = 1
+   //   Interleaved [uvw uvw ...] layout: xCompStride = 1,  xNodeStride = 3
+   // Same is true for y.
+
+   // If beta is zero y is not read, i.e. it does not need to be initialized.
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < m; i++) {
+      double sum0 = 0.0;
+      double sum1 = 0.0;
+      double sum2 = 0.0;
+
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         double a = value[j];
+         int xIndex = col[j] * xNodeStride;
+         sum0 += a * x[xIndex];
+         sum1 += a * x[xIndex + xCompStride];
+         sum2 += a * x[xIndex + 2*xCompStride];
+      }
+
+      int yIndex = i * yNodeStride;
+      if (beta == 0.0) {
+         y[yIndex]                 = alpha * sum0;
+         y[yIndex + yCompStride]   = alpha * sum1;
+         y[yIndex + 2*yCompStride] = alpha * sum2;
+      } else {
+         y[yIndex]                 = alpha * sum0 + beta * y[yIndex];
+         y[yIndex + yCompStride]   = alpha * sum1 + beta * y[yIndex + yCompStride];
+         y[yIndex + 2*yCompStride] = alpha * sum2 + beta * y[yIndex + 2*yCompStride];
+      }
+   }
+
+}  // End of function csrMultiply3()
+
+
+
+
+
+//========================================================================
+void csrGradient(int m, double alpha, double *value3, int *col, int *rowStarts,
+                 double *p, double beta, double *y, int yCompStride, int yNodeStride)
+//========================================================================
+{
+   // Calculates y = alpha * [G] * p + beta * y, where [G] = [G1; G2; G3] is
+   // stored as a single m x NNp CSR matrix whose nonzeros carry three values
+   // each, stored consecutively in value3 (see setupInterleavedG()). All three
+   // components of y are calculated in one pass over [G]. Storage of y is
+   // described in csrMultiply3().
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < m; i++) {
+      double sum0 = 0.0;
+      double sum1 = 0.0;
+      double sum2 = 0.0;
+
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         double pj = p[col[j]];
+         sum0 += value3[3*j]     * pj;
+         sum1 += value3[3*j + 1] * pj;
+         sum2 += value3[3*j + 2] * pj;
+      }
+
+      int yIndex = i * yNodeStride;
+      if (beta == 0.0) {
+         y[yIndex]                 = alpha * sum0;
+         y[yIndex + yCompStride]   = alpha * sum1;
+         y[yIndex + 2*yCompStride] = alpha * sum2;
+      } else {
+         y[yIndex]                 = alpha * sum0 + beta * y[yIndex];
+         y[yIndex + yCompStride]   = alpha * sum1 + beta * y[yIndex + yCompStride];
+         y[yIndex + 2*yCompStride] = alpha * sum2 + beta * y[yIndex + 2*yCompStride];
+      }
+   }
+
+}  // End of function csrGradient()
+
+
+
+
+
+//========================================================================
+void csrScaledGradient(int m, double *value3, int *col, int *rowStarts,
+                       double *p, double *scale, double *y)
+//========================================================================
+{
+   // Calculates y = scale * ([G] * p), where the product with scale is
+   // entrywise and the same scale[i] is used for all three components of
+   // node i. [G] is stored as in csrGradient(). y is interleaved, i.e.
+   // component c of node i is y[3*i + c]. This is the first half of the
+   // matrix-free product with [Z] (see multiplyZMatrixFree()), which is
+   // completed by csrDivergence().
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < m; i++) {
+      double sum0 = 0.0;
+      double sum1 = 0.0;
+      double sum2 = 0.0;
+
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         double pj = p[col[j]];
+         sum0 += value3[3*j]     * pj;
+         sum1 += value3[3*j + 1] * pj;
+         sum2 += value3[3*j + 2] * pj;
+      }
+
+      double s = scale[i];
+      y[3*i]     = s * sum0;
+      y[3*i + 1] = s * sum1;
+      y[3*i + 2] = s * sum2;
+   }
+
+}  // End of function csrScaledGradient()
+
+
+
+
+
+//========================================================================
+void csrDivergence(int n, double alpha, double *valueT3, int *colT, int *rowStartsT,
+                   double *d, int dCompStride, int dNodeStride, double beta, double *y)
+//========================================================================
+{
+   // Calculates y = alpha * (G1^T d1 + G2^T d2 + G3^T d3) + beta * y in one
+   // pass. Instead of a transposed multiplication, which needs scattered
+   // writes, the explicitly stored transpose of [G] (n = NNp rows, see
+   // setupInterleavedG()) is used so that each row of y is calculated by a
+   // single thread. Storage of d is described in csrMultiply3().
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < n; i++) {
+      double sum = 0.0;
+
+      for (int j = rowStartsT[i]; j < rowStartsT[i+1]; j++) {
+         int dIndex = colT[j] * dNodeStride;
+         sum += valueT3[3*j]     * d[dIndex] +
+                valueT3[3*j + 1] * d[dIndex + dCompStride] +
+                valueT3[3*j + 2] * d[dIndex + 2*dCompStride];
+      }
+
+      if (beta == 0.0) {
+         y[i] = alpha * sum;
+      } else {
+         y[i] = alpha * sum + beta * y[i];
+      }
+   }
+
+}  // End of function csrDivergence()
+
+
+
+
+
+
+//========================================================================
+void step3FusedUpdate(int NN, double dt, double *value3, int *col, int *rowStarts,
+                      double *Pdot, double *KtimesAcc_prev, double *MdInv,
+                      double *UnpHalf, double *Unp1_prev, double *Acc, double *Unp1,
+                      double *normSqr, double *diffNormSqr)
+//========================================================================
+{
+   // Performs all vector operations of step 3 in a single pass over the
+   // velocity nodes.
+   //    R3   = - dt * (G * Pdot + K * Acc_prev)
+   //    Acc  = R3 * MdInv
+   //    Unp1 = UnpHalf + dt * Acc
+   // Velocity BCs are not applied to R3 explicitly. MdInv is zero at the
+   // velocity BC nodes (see applyBC_Step1()), which makes Acc zero there.
+   // KtimesAcc_prev can be NULL, in which case it is taken to be zero.
+
+   // As a by-product the squares of the norms of Unp1 and (Unp1 - Unp1_prev)
+   // are returned, to be used in the convergence check of timeLoop().
+
+   double sum1 = 0.0;
+   double sum2 = 0.0;
+
+   #pragma omp parallel for schedule(static) reduction(+:sum1,sum2)
+   for (int i = 0; i < NN; i++) {
+      double gradP[3] = {0.0, 0.0, 0.0};
+
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         double pj = Pdot[col[j]];
+         gradP[0] += value3[3*j]     * pj;
+         gradP[1] += value3[3*j + 1] * pj;
+         gradP[2] += value3[3*j + 2] * pj;
+      }
+
+      for (int c = 0; c < 3; c++) {
+         int k = i + c*NN;
+
+         double R3 = gradP[c];
+         if (KtimesAcc_prev != NULL) {
+            R3 += KtimesAcc_prev[k];
+         }
+         R3 = -dt * R3;
+
+         double a = R3 * MdInv[k];
+         double u = UnpHalf[k] + dt * a;
+         Acc[k]  = a;
+         Unp1[k] = u;
+
+         double diff = u - Unp1_prev[k];
+         sum1 += u * u;
+         sum2 += diff * diff;
+      }
+   }
+
+   *normSqr     = sum1;
+   *diffNormSqr = sum2;
+
+}  // End of function step3FusedUpdate()
+
+
+
+
+
+//========================================================================
+void vectorCopy(int n, double *x, double *y)
+//========================================================================
+{
+   // y = x
+
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      y[i] = x[i];
+   }
+
+}  // End of function vectorCopy()
+
+
+
+
+
+//========================================================================
+void vectorSet(int n, double value, double *x)
+//========================================================================
+{
+   // x = value
+
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      x[i] = value;
+   }
+
+}  // End of function vectorSet()
+
+
+
+
+
+//========================================================================
+void vectorUpdate(int n, double *z, double alpha, double *x, double beta, double *a, double *b)
+//========================================================================
+{
+   // z = alpha * x + beta * a * b, where a * b is an entrywise product.
+   // If b is NULL, z = alpha * x + beta * a.
+   // If a is NULL, z = alpha * x.
+   // z can be the same array as x, a or b.
+
+   if (a == NULL) {
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         z[i] = alpha * x[i];
+      }
+   } else if (b == NULL) {
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         z[i] = alpha * x[i] + beta * a[i];
+      }
+   } else {
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         z[i] = alpha * x[i] + beta * a[i] * b[i];
+      }
+   }
+
+}  // End of function vectorUpdate()
+
+
+
+
+
+//========================================================================
+void vectorDifferenceNorms(int n, double *x, double *xPrev, double *normSqr, double *diffNormSqr)
+//========================================================================
+{
+   // Calculates the squares of the norms of x and (x - xPrev) in a single pass.
+
+   double sum1 = 0.0;
+   double sum2 = 0.0;
+
+   #pragma omp parallel for simd schedule(static) reduction(+:sum1,sum2)
+   for (int i = 0; i < n; i++) {
+      double diff = x[i] - xPrev[i];
+      sum1 += x[i] * x[i];
+      sum2 += diff * diff;
+   }
+
+   *normSqr     = sum1;
+   *diffNormSqr = sum2;
+
+}  // End of function vectorDifferenceNorms()
+
+
+
+
+
+//========================================================================
+double vectorMaxAbsDifference(int n, double *x, double *y)
+//========================================================================
+{
+   // Returns the maximum of |x - y|.
+
+   double maxDiff = 0.0;
+
+   #pragma omp parallel for simd schedule(static) reduction(max:maxDiff)
+   for (int i = 0; i < n; i++) {
+      double diff = fabs(x[i] - y[i]);
+      if (diff > maxDiff) {
+         maxDiff = diff;
+      }
+   }
+
+   return maxDiff;
+
+}  // End of function vectorMaxAbsDifference()
+
+
+
+
+
+//========================================================================
+double vectorDot(int n, double *x, double *y)
+//========================================================================
+{
+   // Returns the dot product of x and y.
+
+   double sum = 0.0;
+
+   #pragma omp parallel for simd schedule(static) reduction(+:sum)
+   for (int i = 0; i < n; i++) {
+      sum += x[i] * y[i];
+   }
+
+   return sum;
+
+}  // End of function vectorDot()
+
+
+
+
+
+//========================================================================
+double csrMultiplyDot(int n, double *value, int *col, int *rowStarts, double *x, double *y)
+//========================================================================
+{
+   // Calculates y = [A] * x, where [A] is an n x n CSR matrix with 0-based
+   // indices, and returns the dot product of x and y. Both are done in the
+   // same pass, so that y is not read again for the dot product.
+
+   double sum = 0.0;
+
+   #pragma omp parallel for schedule(static) reduction(+:sum)
+   for (int i = 0; i < n; i++) {
+      double Ax = 0.0;
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         Ax += value[j] * x[col[j]];
+      }
+      y[i] = Ax;
+      sum += x[i] * Ax;
+   }
+
+   return sum;
+
+}  // End of function csrMultiplyDot()
+
+
+
+
+
+//========================================================================
+double cgUpdate(int n, double alpha, double *p, double *q, double *x, double *r)
+//========================================================================
+{
+   // Solution and residual update of a CG iteration, x = x + alpha * p and
+   // r = r - alpha * q. Returns the square of the norm of the new residual.
+
+   double sum = 0.0;
+
+   #pragma omp parallel for simd schedule(static) reduction(+:sum)
+   for (int i = 0; i < n; i++) {
+      x[i] += alpha * p[i];
+      r[i] -= alpha * q[i];
+      sum += r[i] * r[i];
+   }
+
+   return sum;
+
+}  // End of function cgUpdate()
@@ -26,13 +26,12 @@
 ********************************************************************
                        THIRD PARTY LIBRARIES
 ********************************************************************
-  CPU version: CSparse library of Timothy Davis is used in the
-               creation of the [Z] matrix (especially necessary for
-               the sparse matrix-matrix multiplication).
-  
-               In step 2, Intel MKL's Conjugate Gradient solver is
-               used. N_MKL_THREADS variable sets the number of
-               parallel threads used by MKL.
+  CPU version: In step 2, the preconditioned Conjugate Gradient
+               solver of pressureSolvers.cpp is used by default.
+               Intel MKL's Conjugate Gradient solver can be selected
+               instead (see INPUT and OUTPUT FILES). N_MKL_THREADS
+               variable sets the number of parallel threads used by
+               MKL.
 
   GPU version: It uses NVIDIA's CUDA Toolkit. CUSP library is used
                to calculate the [Z] matrix and Conjugate Gradient
@@ -49,6 +48,13 @@
   USECUDA:    NVIDIA's CUDA library is used to perform certain
               tasks on a graphics card (GPU).
 
+  COUNT_ALLOCATIONS: Debugging aid for the CPU version. Global
+              operator new is replaced by a counting one and the
+              program stops if any heap allocation is made during a
+              time step. All temporaries of the time loop are kept
+              in a preallocated workspace, so this should never
+              happen.
+
 
 ********************************************************************
                        INPUT and OUTPUT FILES
@@ -59,6 +65,84 @@
            in the ProblemName.txt file. It includes only corner
            nodes of the elements, not mid-edge, mid-face or
            mid-element nodes.
+
+           Lines of the form "key : value" that follow the monitor
+           point coordinates are optional solver settings. Keys that
+           are not given keep their default values, which are set
+           where the corresponding global variables are defined.
+             pressureSolver         : 0 MKL's CG, 1 native PCG,
+                                      2 preconditioner iterations
+                                        (standalone multigrid), needs
+                                        preconditioner 2-6 or 8,
+                                      3 sparse Cholesky factorization,
+                                        done once in step0(),
+                                      4 single precision PCG with
+                                        double precision iterative
+                                        refinement
+             pressurePreconditioner : 0 none, 1 Jacobi, 2 AMG, 3 GMG,
+                                      4 IC(0), 5 two-level deflation,
+                                      6 Chebyshev polynomial,
+                                      7 additive Schwarz, 8 FSAI
+             pressureChebyshevDegree : Degree of the Chebyshev
+                                      preconditioner
+             pressureFSAIPattern    : Pattern of the FSAI preconditioner,
+                                      1 lower triangle of Z, 2 lower
+                                      triangle of the square of the
+                                      strong connections of Z
+             pressureTolerance      : Relative residual tolerance
+             pressureAdaptiveTolerance : 1 to scale the tolerance with
+                                      the change of the previous inner
+                                      iteration, 0 to use
+                                      pressureTolerance
+             pressureAdaptiveFactor : Ratio of the tolerance to that
+                                      change
+             pressureToleranceMin   : Lower bound of the adaptive
+                                      tolerance, used in the last
+                                      inner iteration
+             pressureToleranceMax   : Upper bound of the adaptive
+                                      tolerance, used in the first
+                                      inner iteration
+             pressureMaxIter        : Max. number of CG iterations
+             pressureCGVariant      : 0 standard PCG, 1 pipelined PCG,
+                                      2 s-step CG (Jacobi scaling,
+                                        ignores the preconditioner)
+             pressureCGSteps        : s of s-step CG, at most 8
+             pressureRecycleVectors : Number of approximate eigenvectors
+                                      recycled by the standard PCG,
+                                      0 for no recycling
+             pressureRecycleSolves  : Number of solves that refine
+                                      the recycled vectors
+             pressureNullSpace      : 0 pressure of zeroPressureNode is
+                                        fixed with a large diagonal,
+                                      1 singular [Z] with projected
+                                        solves, 2 elimination of
+                                        zeroPressureNode
+             pressureOperator       : 0 [Z] = Gt*inv(Md)*G, 1 Q1
+                                      pressure Laplacian, which is
+                                      sparser but leaves a divergence
+                                      error of order dt^2*h^2 (see
+                                      calculateZLaplacian())
+             pressureMatrixFree     : 1 [Z] is not formed and is
+                                      applied as Gt*(MdOrigInv*(G*p)),
+                                      needs native PCG with Jacobi or
+                                      no preconditioner, several times
+                                      slower, use only when [Z] does
+                                      not fit in memory,
+                                      0 [Z] is stored
+             pressureInitialGuess   : 0 zero, 1 previous solution,
+                                      2 projection onto previous
+                                        solutions
+             pressureProjectionWindow : Max. number of previous
+                                      solutions used by projection
+             innerPredictor         : Initial values of the inner
+                                      iterations. 0 Un and zero
+                                      acceleration, 1 2*Un - Un-1 and
+                                      acceleration of the previous
+                                      time step
+             andersonWindow         : Number of previous inner
+                                      iterations used by Anderson
+                                      acceleration, 0 for plain
+                                      fixed-point iterations
        
   DAT:     Output file with velocity components and pressure to be
            visualized using the Tecplot software.
@@ -107,6 +191,12 @@ bool PRINT_TIMES = 1;               // Set to 1 to see the time taken by each st
 
 //extern "C" void mkl_freebuffers();
 
+#ifdef COUNT_ALLOCATIONS
+   #include <atomic>
+   #include <new>
+   #include <cstdlib>
+#endif
+
 #ifdef USECUDA
    #include <cuda_runtime.h>
    #include "cublas_v2.h"
@@ -120,11 +210,6 @@ bool PRINT_TIMES = 1;               // Set to 1 to see the time taken by each st
    #include <sys/time.h>
 #endif
 
-
-extern "C" {      // Timothy Davis' CSparse library. Used to calculate [Z] matrix on the CPU.
-#include "cs.h"
-}
-
 using namespace std;
 
 #ifdef SINGLE              // Many major parameters can automatically be defined as                                                                  TODO: Use "real" throughout the code.
@@ -163,6 +248,37 @@ int    maxIter;    // Maximum iteration number performed inside each time step
 double tolerance;  // Tolerance for the iterations performed in each time step
 double convergenceCriteria;   // Convergence criteria for steady state problems
 
+// Settings of the pressure solver of step 2. These default values can be changed
+// by the optional settings at the end of the input file.
+int    pressureSolver = 1;             // 0: MKL's CG, 1: Native PCG of pressureSolvers.cpp, 2: Iterations of the preconditioner alone, e.g. standalone multigrid. Only for preconditioners 2-6 and 8, the others diverge. 3: Direct solve with a sparse Cholesky factorization of [Z], 4: Single precision PCG corrections with double precision iterative refinement
+int    pressurePreconditioner = 1;     // Preconditioner of the native solvers. 0: None, 1: Jacobi, 2: Smoothed aggregation AMG, 3: Geometric multigrid, 4: IC(0), 5: Two-level deflation with subdomain coarse space, 6: Chebyshev polynomial, 7: Additive Schwarz with local Cholesky solves, 8: FSAI
+int    pressureChebyshevDegree = 4;    // Degree of the Chebyshev polynomial preconditioner
+int    pressureFSAIPattern = 1;        // Sparsity pattern of the FSAI preconditioner. 1: Lower triangle of Z, 2: Lower triangle of the square of the strong connections of Z
+double pressureTolerance = 1e-6;       // CG stops when ||r|| <= pressureTolerance * ||R2||. MKL's CG compares squared norms, so it is given the square of this.
+int    pressureMaxIter = 1000;         // Max. number of CG iterations in a single solve
+int    pressureAdaptiveTolerance = 0;  // 1: Tolerance of each solve follows the convergence of the inner iterations of the time step (see pressureSolveTolerance()), 0: pressureTolerance is used
+double pressureAdaptiveFactor = 0.1;   // Adaptive tolerance is this times the normalized change of the previous inner iteration
+double pressureToleranceMin = 1e-6;    // Bounds of the adaptive tolerance
+double pressureToleranceMax = 1e-2;
+double lastOuterChange = -1.0;         // Larger of the normalized velocity and pressure changes of the last inner iteration
+int    pressureCGVariant = 0;          // CG of the native solver. 0: Standard PCG, 1: Pipelined PCG, 2: s-step CG. Last two need fewer reductions per iteration.
+int    pressureCGSteps = 4;            // Number of steps s of s-step CG, at most 8 (see SSTEP_MAX_STEPS)
+int    pressureRecycleVectors = 0;     // Number of approximate eigenvectors of the smallest eigenvalues recycled across the solves by deflated PCG. 0: No recycling. Used with the standard PCG.
+int    pressureRecycleSolves = 10;     // Number of the first solves that refine the recycled vectors
+int    pressureNullSpace = 0;          // How the level of pressure is fixed. 0: Diagonal of [Z] at zeroPressureNode is multiplied by a large number, 1: Projected solves of the singular system, 2: Elimination of zeroPressureNode. See applyBC_Step2().
+bool   pressureHasNullSpace = 0;       // True if constant pressure is in the null space of [Z]. Set in applyBC_Step2() when pressureNullSpace is 1.
+int    pressureOperator = 0;           // Operator of the pressure equation of step 2. 0: [Z] = Gt * inv(Md) * G, 1: Q1 pressure Laplacian (see calculateZLaplacian())
+int    pressureMatrixFree = 0;         // 1: [Z] is never formed. Solvers apply it as Gt * (MdOrigInv * (G * p)), which is several times slower than a product with the stored [Z]. Only for when [Z] does not fit in memory. 0: [Z] is stored.
+int    pressureInitialGuess = 2;       // Initial guess of the iterative solvers. 0: Zero, 1: Previous solution, 2: Z-orthogonal projection onto the previous solutions (Fischer's method)
+int    pressureProjectionWindow = 8;   // Max. number of previous solutions used by the projection
+
+int    innerPredictor = 0;             // Input of the first inner iteration of a time step. 0: UnpHalf_prev = Un and Acc_prev = 0, 1: UnpHalf_prev = 2*Un - Un-1 and Acc_prev = Acc of the previous time step
+int    andersonWindow = 0;             // Number of previous inner iterations used by Anderson acceleration of the inner iterations of a time step (see andersonUpdate()). 0: Plain fixed-point iterations.
+
+int    nPressureSolves = 0;            // Statistics of the pressure solves, printed at the end of the run.
+long   nPressureIterations = 0;
+double pressureSolveTime = 0.0;
+
 bool   isRestart;  // Switch that defines if solver continues from a previous
                    // solution or starts from the initial condition
 double density;    // Density of the material
@@ -228,20 +344,47 @@ int *sparseGrow;          // Nonzero rows of only one sub G matrix.
 int *sparseGrowStarts;    // Row start indices of G matrix (for CSR storage).
 int *sparseGrowStartsMod; // A modified version of the above array, used by MKL
 
-double *KtimesAcc_prev;   // Multiplication of [K]{Acc_prev}
-
-
-cs *G1_cs, *G2_cs, *G3_cs, *G1_cs_CSC, *G2_cs_CSC, *G3_cs_CSC;    // CSparse storage of sub [G] matrices
-cs *G1t_cs_CSC, *G2t_cs_CSC, *G3t_cs_CSC;                         // CSparse storage of tranposes of sub [G] matrices
+double *sparseGvalue;     // Nonzero values of G1, G2 and G3 in an interleaved way, i.e. the 3 values of each nonzero are stored consecutively. Uses sparseGcol and sparseGrowStarts.
+double *sparseGtValue;    // Interleaved nonzero values of the transpose of G (size:NNp x NN). Used in the calculation of Gt * {vector}.
+int *sparseGtCol;         // Nonzero columns of the transpose of G.
+int *sparseGtRowStarts;   // Row start indices of the transpose of G.
 
-cs *Z_cs;                 // [Z] matrix calculated by CSparse library.
-cs *Z_csSorted;           // [Z] matrix with columns indices sorted in ascending order.
-
-
-// Used by MKL_CG
+double *KtimesAcc_prev;   // Multiplication of [K]{Acc_prev}
+bool    accCarriedOver = 0;   // True if Acc_prev of the first inner iteration is the acceleration of the previous time step (innerPredictor = 1). Otherwise it is zero.
+
+double *Unm1;             // Velocity of time step n-1. Used by the predictor of innerPredictor = 1.
+bool    Unm1isSet = 0;    // False until the first time step is completed
+
+// Anderson acceleration of the inner iterations (see andersonUpdate()).
+// Vectors are of size 6*NN and stack a velocity and dt times an
+// acceleration, [UnpHalf; dt * Acc].
+double *andersonX;             // Input of the current inner iteration
+double *andersonF, *andersonG; // Residual F(x) - x and output F(x) of the current inner iteration
+double *andersonFprev, *andersonGprev;   // Same of the previous inner iteration
+double **andersonDF, **andersonDG;       // Differences of successive residuals and outputs. Circular storage of andersonWindow columns.
+double *andersonGram;          // Gram matrix of the columns of andersonDF, andersonWindow x andersonWindow
+double *andersonL;             // Cholesky factor of the regularized Gram matrix
+double *andersonGamma;         // Mixing coefficients, followed by the right hand side of their normal equations
+int andersonNstored;           // Number of stored columns
+int andersonNext;              // Column that is overwritten next
+double andersonFnormPrev;      // Norm of the residual of the previous inner iteration
+
+
+// Upper triangle of [Z]. Calculated with 0-based indices by calculateZ() and
+// switched to 1-based indices for MKL_CG by setupZStorage().
 int Z_NNZupper, *Z_rowStartsUpper, *Z_colIndicesUpper;
 double *Z_valuesUpper;
 
+// Used by the native solvers of pressureSolvers.cpp. All rows of [Z] with 0-based indices.
+int Z_NNZ, *Z_rowStarts, *Z_col;
+double *Z_value;
+
+// Used instead of the above when pressureMatrixFree is 1 (see multiplyZMatrixFree()).
+double *Z_diagonal;          // Diagonal of [Z], with pressure BCs applied
+double *Z_pinnedColumn;      // Column zeroPressureNode of [Z] without pressure BCs. Used when pressureNullSpace is 2.
+double  Z_pinShift = 0.0;    // Added to the diagonal of zeroPressureNode when pressureNullSpace is 0
+double *Z_work;              // MdOrigInv * (G * p), interleaved. Size is 3*NN.
+
 
 
 int ***sparseMapM;        // Maps each element's local M, K, A entries to the global ones that are stored in sparse format.
@@ -258,30 +401,28 @@ double **detJacob;        // Determinant of the Jacobian matrix evaluated at a c
 double ****gDSp;          // Derivatives of shape functions for pressure wrt x, y & z at GQ points. (size:3xNENvxNGP)
 double ****gDSv;          // Derivatives of shape functions for velocity wrt x, y & z at GQ points. (size:3xNENvxNGP)
 
-double *Un;               // x, y and z velocity components of time step n.
-double *Unp1;             // U_i+1^n+1 of the reference paper.
-double *Unp1_prev;        // U_i^n+1 of the reference paper.
-double *UnpHalf;          // U_i+1^n+1/2 of the reference paper.
-double *UnpHalf_prev;     // U_i^n+1/2 of the reference paper.
+double *Un;               // x, y and z velocity components of time step n. Points into workspace.velocityPool.
+double *Unp1;             // U_i+1^n+1 of the reference paper. Points into workspace.velocityPool.
+double *Unp1_prev;        // U_i^n+1 of the reference paper. Points into workspace.velocityPool.
+double *UnpHalf;          // U_i+1^n+1/2 of the reference paper. Points into workspace.velocityPool.
+double *UnpHalf_prev;     // U_i^n+1/2 of the reference paper. Points into workspace.velocityPool.
 
-double *Acc;              // A_i+1^n+1 of the reference paper.
+double *Acc;              // A_i+1^n+1 of the reference paper. Swapped with Acc_prev in timeLoop().
 double *Acc_prev;         // A_i^n+1 of the reference paper.
 
-double *Pn;               // Pressure of time step n.
-double *Pnp1;             // U_i+1^n+1 of the reference paper.
-double *Pnp1_prev;        // p_i+1^n+1 of the reference paper.
+double *Pn;               // Pressure of time step n. Points into workspace.pressurePool.
+double *Pnp1;             // U_i+1^n+1 of the reference paper. Points into workspace.pressurePool.
+double *Pnp1_prev;        // p_i+1^n+1 of the reference paper. Points into workspace.pressurePool.
 double *Pdot;             // Pdot_i+1^n+1 of the reference paper.
 
 double *Md;               // Diagonalized mass matrix with BCs applied
 double *MdOrig;           // Diagonalized mass matrix without BCs applied
-double *MdInv;            // Inverse of the diagonalized mass matrix with BCs applied
+double *MdInv;            // Inverse of the diagonalized mass matrix with BCs applied. It is zero at velocity BC nodes.
 double *MdOrigInv;        // Inverse of the diagonalized mass matrix without BCs applied
 
 double *R1;               // RHS vector of intermediate velocity calculation.
-double *R11, *R12, *R13;
+double *R11, *R12, *R13;  // u, v and w parts of R1. They point into R1, i.e. they are not allocated separately.
 double *R2;               // RHS vector of pressure calculation.
-double *R3;               // RHS vector of new velocity calculation.
-double *R31, *R32, *R33;
 
 double *gDSv_1d, *GQfactor_1d, *Sv_1d;
 int    *sparseMapM_1d;
@@ -289,10 +430,49 @@ int    *LtoGvel_1d;
 
 double StartCurrentTimeStep, wallClockTimeCurrentTimeStep;
 bool checkAccConvergence;
+double Unp1NormSqr;       // Square of the norm of Unp1. Calculated in step3() for the convergence check.
+double Unp1DiffNormSqr;   // Square of the norm of (Unp1 - Unp1_prev). Calculated in step3() for the convergence check.
 double maxAcc;
 char dummyUserInput;      // Used for debugging
 
 
+// Workspace of the CPU time loop. Every temporary array that is needed inside
+// the time loop is allocated only once, in allocateWorkspace(), and is kept for
+// the whole run. Velocity and pressure vectors of the iterations (Un, Unp1,
+// Unp1_prev, UnpHalf, UnpHalf_prev and Pn, Pnp1, Pnp1_prev) are not allocated
+// separately but point to the buffers of the two pools below. timeLoop()
+// rotates these pointers instead of copying the vectors.
+struct SolverWorkspace {
+   double *velocityPool[5];  // 5 buffers of size 3*NN for the velocity vectors.
+   double *pressurePool[3];  // 3 buffers of size NNp for the pressure vectors.
+   double *step2RHS;         // (UnpHalf / (dt*dt) - MdOrigInv * K * Acc_prev) of step2(). Size is 3*NN.
+   double *CGtmp;            // Work array of MKL's CG solver. Size is 4*NNp.
+   int     nThreads;         // Number of openMP threads that elementScratch is allocated for.
+   int     elementScratchSize;   // Size of the scratch array of a single thread.
+   double *elementScratch;   // Elemental arrays used by calculateMatrixA(). Each thread uses its own part.
+};
+SolverWorkspace workspace;
+
+#ifdef COUNT_ALLOCATIONS
+   std::atomic<long> nHeapAllocations(0);   // Number of calls to operator new. Used to check that there are no allocations in the time loop.
+
+   void *operator new(size_t size)
+   {
+      nHeapAllocations++;
+      void *p = malloc(size > 0 ? size : 1);
+      if (p == NULL) {
+         throw std::bad_alloc();
+      }
+      return p;
+   }
+
+   void operator delete(void *p) noexcept
+   {
+      free(p);
+   }
+#endif
+
+
 
 // CUDA DEVICE variables. Their names end with "_d".
 #ifdef USECUDA
@@ -344,22 +524,32 @@ void setupGQ();
 void calcShape();
 void calcJacob();
 void initializeAndAllocate();
+void allocateWorkspace();
+double *findFreeBuffer(double **, int, double **, int);
 void readRestartFile();
 void createTecplot();
 void timeLoop();
 void step0();
 void calculateZ();
-void extractUpperTriangularPartOfZ();
+void calculateZLaplacian();
+void setupZStorage();
+void setupInterleavedG();
+void setupMatrixFreeZ();
+void multiplyZMatrixFree(double *, double *);
 void calculateMatrixA();
 void step1(int);
 void step2(int);
 void step3(int);
+void setupAnderson();
+void andersonStart();
+void andersonUpdate(int);
+double pressureSolveTolerance(int);
 void MKL_CG_solver(int);
+void nativePressureSolver(int);
 void applyBC_initial();
 void applyBC_Step1(int);
 void applyBC_Step2(int);
-void applyBC_Step3();
-void waitForUser(string);
+void waitForUser(const char *);
 
 // Functions that are used when USECUDA option is defined.
 #ifdef USECUDA
@@ -376,6 +566,40 @@ void waitForUser(string);
    void printMonitorDataGPU(int);
  #endif
 
+// Sparse and vector kernels of the CPU version (CPUcodes.cpp).
+void csrMultiply3(int, double, double *, int *, int *, double *, int, int, double, double *, int, int);
+void csrGradient(int, double, double *, int *, int *, double *, double, double *, int, int);
+void csrDivergence(int, double, double *, int *, int *, double *, int, int, double, double *);
+void csrScaledGradient(int, double *, int *, int *, double *, double *, double *);
+void step3FusedUpdate(int, double, double *, int *, int *, double *, double *, double *, double *, double *, double *, double *, double *, double *);
+void vectorCopy(int, double *, double *);
+void vectorSet(int, double, double *);
+void vectorUpdate(int, double *, double, double *, double, double *, double *);
+void vectorDifferenceNorms(int, double *, double *, double *, double *);
+double vectorDot(int, double *, double *);
+double vectorMaxAbsDifference(int, double *, double *);
+
+// Solvers of the pressure equation of step 2 (pressureSolvers.cpp).
+bool setupPressureSolver(int, int *, int *, double *, int, double **);
+void setPressureOperator(int, void (*)(double *, double *), double *);
+void setPressureNullSpaceProjection(bool);
+void setChebyshevDegree(int);
+void setFSAIPattern(int);
+int solvePressurePCG(double *, double *, double, int, double *);
+int solvePressureRichardson(double *, double *, double, int, double *);
+void setupPressureMixedPrecision();
+int solvePressureMixedPrecision(double *, double *, double, int, double *);
+bool setupPressureCholesky(int, int *, int *, double *, double **);
+void solvePressureCholesky(double *, double *, double *);
+void setupPressureCGVariant(int, int);
+int solvePressurePipelinedCG(double *, double *, double, int, double *);
+int solvePressureSstepCG(double *, double *, double, int, double *);
+void setupPressureRecycling(int, int);
+int solvePressureRecycledPCG(double *, double *, double, int, double *);
+bool setupPressureInitialGuess(int, int *, int *, double *, int, int);
+void initialPressureGuess(double *, double *);
+void savePressureSolution(double *);
+
 
 
 
@@ -710,9 +934,79 @@ void readInputFile()
    inpFile.ignore(256, '\n'); // Read and ignore the line
    inpFile.ignore(256, '\n'); // Read and ignore the line
    inpFile >> monPointCoord[0] >> monPointCoord[1] >> monPointCoord[2];
+   inpFile.ignore(256, '\n'); // Ignore the rest of the line
+   
+   
+   
+   // Read the optional solver settings, given as "key : value" lines.
+   string line, key;
+   while (getline(inpFile, line)) {
+      size_t colon = line.find(':');
+      if (colon == string::npos) {
+         continue;
+      }
+      istringstream keyStream(line.substr(0, colon));
+      istringstream valueStream(line.substr(colon + 1));
+      key = "";
+      keyStream >> key;
+
+      if (key == "pressureSolver") {
+         valueStream >> pressureSolver;
+      } else if (key == "pressurePreconditioner") {
+         valueStream >> pressurePreconditioner;
+      } else if (key == "pressureChebyshevDegree") {
+         valueStream >> pressureChebyshevDegree;
+      } else if (key == "pressureFSAIPattern") {
+         valueStream >> pressureFSAIPattern;
+      } else if (key == "pressureTolerance") {
+         valueStream >> pressureTolerance;
+      } else if (key == "pressureMaxIter") {
+         valueStream >> pressureMaxIter;
+      } else if (key == "pressureAdaptiveTolerance") {
+         valueStream >> pressureAdaptiveTolerance;
+      } else if (key == "pressureAdaptiveFactor") {
+         valueStream >> pressureAdaptiveFactor;
+      } else if (key == "pressureToleranceMin") {
+         valueStream >> pressureToleranceMin;
+      } else if (key == "pressureToleranceMax") {
+         valueStream >> pressureToleranceMax;
+      } else if (key == "pressureCGVariant") {
+         valueStream >> pressureCGVariant;
+      } else if (key == "pressureCGSteps") {
+         valueStream >> pressureCGSteps;
+      } else if (key == "pressureRecycleVectors") {
+         valueStream >> pressureRecycleVectors;
+      } else if (key == "pressureRecycleSolves") {
+         valueStream >> pressureRecycleSolves;
+      } else if (key == "pressureNullSpace") {
+         valueStream >> pressureNullSpace;
+      } else if (key == "pressureOperator") {
+         valueStream >> pressureOperator;
+      } else if (key == "pressureMatrixFree") {
+         valueStream >> pressureMatrixFree;
+      } else if (key == "pressureInitialGuess") {
+         valueStream >> pressureInitialGuess;
+      } else if (key == "pressureProjectionWindow") {
+         valueStream >> pressureProjectionWindow;
+      } else if (key == "innerPredictor") {
+         valueStream >> innerPredictor;
+      } else if (key == "andersonWindow") {
+         valueStream >> andersonWindow;
+      } else {
+         cout << "WARNING: Unknown setting " << key << " in the input file is ignored." << endl;
+      }
+   }
    
    
    inpFile.close();
+
+   // innerPredictor is needed by initializeAndAllocate(), so it is checked
+   // here. Settings of the pressure solver are checked in step0().
+   if (innerPredictor < 0 || innerPredictor > 1) {
+      printf("ERROR: Unknown inner predictor %d.\n", innerPredictor);
+      printf("Un and zero acceleration will be used instead.\n");
+      innerPredictor = 0;
+   }
    
    
    // Determine NNp, number of pressure nodes
@@ -2721,18 +3015,22 @@ void initializeAndAllocate()
    // Do the necessary memory allocations. Apply the initial condition or read
    // the restart file.
 
-   Un           = new double[3*NN];     // x, y and z velocity components of time step n.
-   Unp1         = new double[3*NN];     // U_i+1^n+1 of the reference paper.
-   Unp1_prev    = new double[3*NN];     // U_i^n+1 of the reference paper.
-   UnpHalf      = new double[3*NN];     // U_i+1^n+1/2 of the reference paper.
-   UnpHalf_prev = new double[3*NN];     // U_i^n+1/2 of the reference paper.
+   allocateWorkspace();
+
+   // Velocity and pressure vectors use the buffers of the workspace. Their
+   // initial assignment is arbitrary, timeLoop() rotates them later.
+   Un           = workspace.velocityPool[0];   // x, y and z velocity components of time step n.
+   Unp1         = workspace.velocityPool[1];   // U_i+1^n+1 of the reference paper.
+   Unp1_prev    = workspace.velocityPool[2];   // U_i^n+1 of the reference paper.
+   UnpHalf      = workspace.velocityPool[3];   // U_i+1^n+1/2 of the reference paper.
+   UnpHalf_prev = workspace.velocityPool[4];   // U_i^n+1/2 of the reference paper.
 
    Acc          = new double[3*NN];     // A_i+1^n+1 of the reference paper.
    Acc_prev     = new double[3*NN];     // A_i^n+1 of the reference paper.
 
-   Pn        = new double[NNp];         // Pressure of time step n.
-   Pnp1      = new double[NNp];         // U_i+1^n+1 of the reference paper.
-   Pnp1_prev = new double[NNp];         // p_i+1^n+1 of the reference paper.
+   Pn        = workspace.pressurePool[0];      // Pressure of time step n.
+   Pnp1      = workspace.pressurePool[1];      // U_i+1^n+1 of the reference paper.
+   Pnp1_prev = workspace.pressurePool[2];      // p_i+1^n+1 of the reference paper.
    Pdot      = new double[NNp];         // Pdot_i+1^n+1 of the reference paper.
 
    Md        = new double[3*NN];        // Diagonalized mass matrix with BCs applied
@@ -2742,17 +3040,17 @@ void initializeAndAllocate()
 
    KtimesAcc_prev = new double[3*NN];   // [K]{Acc_prev}
 
+   if (innerPredictor == 1) {
+      Unm1 = new double[3*NN];          // Velocity of time step n-1
+   }
+
    R1 = new double[3*NN];               // RHS vector of intermediate velocity calculation.
-   R11 = new double[NN];
-   R12 = new double[NN];
-   R13 = new double[NN];
+   R11 = R1;                            // u, v and w parts of R1. calculateMatrixA() assembles into
+   R12 = R1 + NN;                       // them and step1() adds the remaining terms in place, so no
+   R13 = R1 + 2*NN;                     // copy into R1 is necessary.
 
    R2 = new double[NNp];                // RHS vector of pressure calculation.
 
-   R3 = new double[3*NN];               // RHS vector of new velocity calculation.
-   R31 = new double[NN];
-   R32 = new double[NN];
-   R33 = new double[NN];
 
 
    // Initialize all these variables to zero
@@ -2769,16 +3067,6 @@ void initializeAndAllocate()
       MdInv[i]         = 0.0;
       MdOrigInv[i]     = 0.0;
       R1[i]            = 0.0;
-      R3[i]            = 0.0;
-   }
-
-   for (int i = 0; i < NN; i++) {
-      R11[i] = 0.0;
-      R12[i] = 0.0;
-      R13[i] = 0.0;
-      R31[i] = 0.0;
-      R32[i] = 0.0;
-      R33[i] = 0.0;
    }
 
    for (int i = 0; i < NNp; i++) {
@@ -2811,6 +3099,71 @@ void initializeAndAllocate()
 
 
 
+//========================================================================
+void allocateWorkspace()
+//========================================================================
+{
+   // Allocates the buffers of the workspace that are used throughout the time
+   // loop. Nothing is allocated inside the time loop after this.
+
+   for (int b = 0; b < 5; b++) {
+      workspace.velocityPool[b] = new double[3*NN];
+      for (int i = 0; i < 3*NN; i++) {
+         workspace.velocityPool[b][i] = 0.0;
+      }
+   }
+
+   for (int b = 0; b < 3; b++) {
+      workspace.pressurePool[b] = new double[NNp];
+      for (int i = 0; i < NNp; i++) {
+         workspace.pressurePool[b][i] = 0.0;
+      }
+   }
+
+   workspace.step2RHS = new double[3*NN];
+   workspace.CGtmp    = new double[4*NNp];
+
+   // calculateMatrixA() needs u0, v0, w0, uPrev, vPrev, wPrev, R1ue, R1ve and
+   // R1we arrays of size NENv and an Ae_11 array of size NENv x NENv for each
+   // thread.
+   workspace.nThreads = omp_get_max_threads();
+   workspace.elementScratchSize = 9*NENv + NENv*NENv;
+   workspace.elementScratch = new double[workspace.nThreads * workspace.elementScratchSize];
+
+}  // End of function allocateWorkspace()
+
+
+
+
+
+//========================================================================
+double *findFreeBuffer(double **pool, int poolSize, double **inUse, int nInUse)
+//========================================================================
+{
+   // Returns a buffer of the pool that is not one of the nInUse pointers of
+   // the inUse array. Used to rotate the state vectors in timeLoop().
+
+   for (int b = 0; b < poolSize; b++) {
+      bool isFree = 1;
+      for (int i = 0; i < nInUse; i++) {
+         if (pool[b] == inUse[i]) {
+            isFree = 0;
+         }
+      }
+      if (isFree) {
+         return pool[b];
+      }
+   }
+
+   printf("ERROR: No free buffer is left in the workspace.\n");
+   return NULL;
+
+}  // End of function findFreeBuffer()
+
+
+
+
+
 //========================================================================
 void timeLoop()
 //========================================================================
@@ -2821,7 +3174,13 @@ void timeLoop()
    int iter;
    
    double oneOverdt = 1.0000000000000000 / dt;
-   double dummyAcc;
+
+   double *busy[4];     // Buffers of the workspace pools that are in use while a new one is searched.
+   double *swap;
+
+   #if defined(COUNT_ALLOCATIONS) && !defined(USECUDA)
+      long nAllocationsAtStepStart;
+   #endif
    
    
    // Initialize the solution using the specified initial condition and do
@@ -2831,6 +3190,11 @@ void timeLoop()
    // Calculate certain matrices and their inverses only once before the time loop.
    Start = getHighResolutionTime(1, 1.0);
    step0();
+   #ifndef USECUDA
+      if (andersonWindow > 0) {
+         setupAnderson();
+      }
+   #endif
    wallClockTime = getHighResolutionTime(2, Start);
    printf("step0()                took  %8.3f seconds.\n", wallClockTime);
 
@@ -2846,7 +3210,11 @@ void timeLoop()
    cout << " sparseM_NNZ = " << sparseM_NNZ << endl;
    cout << " sparseG_NNZ = " << sparseG_NNZ << endl;
    #ifndef USECUDA
-      cout << " NNZ of upper part of Z = " << Z_NNZupper << endl;
+      if (pressureMatrixFree) {
+         cout << " Z is not formed, it is applied matrix-free" << endl;
+      } else {
+         cout << " NNZ of upper part of Z = " << Z_NNZupper << endl;
+      }
    #endif
    
    printf("\n\nMonitoring node is %d, with coordinates [%f, %f, %f]\n\n\n",
@@ -2860,6 +3228,10 @@ void timeLoop()
       StartCurrentTimeStep = getHighResolutionTime(1, 1.0);   
       timeN = timeN + 1;
       timeT = timeT + dt;
+
+      #if defined(COUNT_ALLOCATIONS) && !defined(USECUDA)
+         nAllocationsAtStepStart = nHeapAllocations;
+      #endif
      
       // Initialize variables for the first iteration.
       #ifdef USECUDA
@@ -2869,14 +3241,43 @@ void timeLoop()
          cudaStatus = cudaMemset((void *)Acc_prev_d, 0, 3*NN * sizeof(double));   if(cudaStatus != cudaSuccess) { printf("Error47: %s\n", cudaGetErrorString(cudaStatus)); cin >> dummyUserInput; }
          cudaThreadSynchronize();
       #else
-         for (int i = 0; i < 3*NN; i++) {
-            UnpHalf_prev[i] = Un[i];
-            //Unp1_prev[i]    = Un[i];
-            Acc_prev[i]     = 0.0;
+         // UnpHalf_prev, Unp1_prev and Pnp1_prev are Un and Pn themselves.
+         // They are only read during the first iteration, so no copy is
+         // necessary. UnpHalf, Unp1 and Pnp1 are written to buffers that are
+         // not in use. Acc_prev does not need to be zeroed, because it is not
+         // used in the first iteration.
+         // With innerPredictor = 1, UnpHalf_prev is extrapolated from the last
+         // two time levels and the acceleration of the last iteration of the
+         // previous time step is kept as Acc_prev, which then is used in the
+         // first iteration. Both are closer to the converged values of this
+         // time step, especially for small dt. The first time step, which has
+         // no previous one, starts as usual.
+         Unp1_prev = Un;
+         busy[0] = Un;
+         accCarriedOver = (innerPredictor == 1 && Unm1isSet);
+         if (accCarriedOver) {
+            UnpHalf_prev = findFreeBuffer(workspace.velocityPool, 5, busy, 1);
+            vectorUpdate(3*NN, UnpHalf_prev, 2.0, Un, -1.0, Unm1, NULL);
+            busy[1] = UnpHalf_prev;
+            UnpHalf = findFreeBuffer(workspace.velocityPool, 5, busy, 2);
+            busy[2] = UnpHalf;
+            Unp1    = findFreeBuffer(workspace.velocityPool, 5, busy, 3);
+
+            swap = Acc_prev;   Acc_prev = Acc;   Acc = swap;
+            csrMultiply3(NN, 1.0, sparseKvalue, sparseMcol, sparseMrowStarts, Acc_prev, NN, 1, 0.0, KtimesAcc_prev, NN, 1);
+         } else {
+            UnpHalf_prev = Un;
+            UnpHalf = findFreeBuffer(workspace.velocityPool, 5, busy, 1);
+            busy[1] = UnpHalf;
+            Unp1    = findFreeBuffer(workspace.velocityPool, 5, busy, 2);
          }
 
-         for (int i = 0; i < NNp; i++) {
-            Pnp1_prev[i] = Pn[i];
+         Pnp1_prev = Pn;
+         busy[0] = Pn;
+         Pnp1 = findFreeBuffer(workspace.pressurePool, 3, busy, 1);
+
+         if (andersonWindow > 0) {
+            andersonStart();
          }
       #endif
 
@@ -2933,22 +3334,13 @@ void timeLoop()
             }
             cudaThreadSynchronize();
          #else
-            double sum1, sum2;
-            sum1 = 0.0;
-            sum2 = 0.0;
-            for (int i=0; i<3*NN; i++) {
-               sum1 = sum1 + Unp1[i] * Unp1[i];
-               sum2 = sum2 + (Unp1[i] - Unp1_prev[i]) * (Unp1[i] - Unp1_prev[i]);
-            }
-            double normalizedNorm1 = sqrt(sum2) / sqrt(sum1);
+            // Norms of the velocity are already calculated in step3().
+            double normalizedNorm1 = sqrt(Unp1DiffNormSqr) / sqrt(Unp1NormSqr);
 
-            sum1 = 0.0;
-            sum2 = 0.0;
-            for (int i=0; i<NNp; i++) {
-               sum1 = sum1 + Pnp1[i] * Pnp1[i];
-               sum2 = sum2 + (Pnp1[i] - Pnp1_prev[i]) * (Pnp1[i] - Pnp1_prev[i]);
-            }
+            double sum1, sum2;
+            vectorDifferenceNorms(NNp, Pnp1, Pnp1_prev, &sum1, &sum2);
             double normalizedNorm2 = sqrt(sum2) / sqrt(sum1);
+            lastOuterChange = max(normalizedNorm1, normalizedNorm2);   // Used by the adaptive pressure tolerance
 
             // CONTROL
             //cout << "timeT = " << timeT << ",   iter = " << iter << endl;
@@ -2960,15 +3352,29 @@ void timeLoop()
                break;
             }
        
-            // Get ready for the next iteration
-            for (int i = 0; i < 3*NN; i++) {
-               UnpHalf_prev[i] = UnpHalf[i];
-               Unp1_prev[i] = Unp1[i];
-               Acc_prev[i] = Acc[i];
-            }
-
-            for (int i = 0; i < NNp; i++) {
-               Pnp1_prev[i] = Pnp1[i];
+            // Get ready for the next iteration. Values of the current iteration
+            // become the "_prev" ones by pointer assignment. New UnpHalf, Unp1
+            // and Pnp1 go into buffers that are not in use. After the last
+            // iteration nothing is rotated, so that Unp1 and Pnp1 keep the
+            // latest values.
+            if (iter < maxIter) {
+               UnpHalf_prev = UnpHalf;
+               Unp1_prev    = Unp1;
+               swap = Acc_prev;   Acc_prev = Acc;   Acc = swap;
+               busy[0] = Un;   busy[1] = UnpHalf_prev;   busy[2] = Unp1_prev;
+               UnpHalf = findFreeBuffer(workspace.velocityPool, 5, busy, 3);
+               busy[3] = UnpHalf;
+               Unp1    = findFreeBuffer(workspace.velocityPool, 5, busy, 4);
+
+               Pnp1_prev = Pnp1;
+               busy[0] = Pn;   busy[1] = Pnp1_prev;
+               Pnp1 = findFreeBuffer(workspace.pressurePool, 3, busy, 2);
+
+               // Replace UnpHalf_prev and Acc_prev, the input of the next
+               // iteration, by a combination of the latest iterations.
+               if (andersonWindow > 0) {
+                  andersonUpdate(iter);
+               }
             }
          #endif
 
@@ -2982,55 +3388,13 @@ void timeLoop()
             calculate_KtimesAcc_prevGPU();
             cudaThreadSynchronize();
          #else
-            char transa, matdescra[6];
-            double alpha, beta;
-            int m = NN;
-
-            matdescra[0] = 'g';
-            matdescra[1] = 'u';
-            matdescra[2] = 'n';
-            matdescra[3] = 'c';
-
-            alpha = 1.0;
-            beta = 0.0;
-            transa = 'n';
-
-            double *KtimesAcc_prevSmall;
-            double *Acc_prevSmall;
-            KtimesAcc_prevSmall = new double[NN];
-            Acc_prevSmall = new double[NN];
-
-            for (int i = 0; i < NN; i++) {
-               Acc_prevSmall[i] = Acc_prev[i];
-            }
-            mkl_dcsrmv(&transa, &m, &m, &alpha, matdescra, sparseKvalue, sparseMcol, sparseMrowStarts, sparseMrowStartsMod, Acc_prevSmall, &beta, KtimesAcc_prevSmall);   // 1st part of [K] * {Acc_prev}
-            for (int i = 0; i < NN; i++) {
-               KtimesAcc_prev[i] = KtimesAcc_prevSmall[i];
-            }
-
-            for (int i = 0; i < NN; i++) {
-               Acc_prevSmall[i] = Acc_prev[i + NN];
-            }
-            mkl_dcsrmv(&transa, &m, &m, &alpha, matdescra, sparseKvalue, sparseMcol, sparseMrowStarts, sparseMrowStartsMod, Acc_prevSmall, &beta, KtimesAcc_prevSmall);   // 2nd part of [K] * {Acc_prev}
-            for (int i = 0; i < NN; i++) {
-               KtimesAcc_prev[i + NN] = KtimesAcc_prevSmall[i];
-            }
-
-            for (int i = 0; i < NN; i++) {
-               Acc_prevSmall[i] = Acc_prev[i + 2*NN];
-            }
-            mkl_dcsrmv(&transa, &m, &m, &alpha, matdescra, sparseKvalue, sparseMcol, sparseMrowStarts, sparseMrowStartsMod, Acc_prevSmall, &beta, KtimesAcc_prevSmall);   // 3rd part of [K] * {Acc_prev}
-            for (int i = 0; i < NN; i++) {
-               KtimesAcc_prev[i + 2*NN] = KtimesAcc_prevSmall[i];
-            }
+            // [K] * {Acc_prev}. u, v and w parts are handled in a single pass over [K].
+            csrMultiply3(NN, 1.0, sparseKvalue, sparseMcol, sparseMrowStarts, Acc_prev, NN, 1, 0.0, KtimesAcc_prev, NN, 1);
 
             //  CONTROL
             //for (int i=0; i<3*NN; i++) {
             //   printf("%d   %g\n", i, KtimesAcc_prev[i]);
             //}
-
-            delete[] KtimesAcc_prevSmall;
-            delete[] Acc_prevSmall;
          
          #endif // USECUDA
 
@@ -3048,13 +3412,7 @@ void timeLoop()
       #else    
          checkAccConvergence = 1;
          
-         maxAcc = 0.00000;
-         for (int i = 0; i < 3*NN; i++) {
-            dummyAcc = (Unp1[i] - Un[i]) * oneOverdt;
-            if (abs(dummyAcc) > maxAcc) {
-               maxAcc = abs(dummyAcc);
-            }
-         }
+         maxAcc = vectorMaxAbsDifference(3*NN, Unp1, Un) * oneOverdt;
          
          if (maxAcc > convergenceCriteria) {
             checkAccConvergence = 0;
@@ -3071,13 +3429,12 @@ void timeLoop()
          cudaStatus = cudaMemcpy(Pn_d, Pnp1_d, NNp  * sizeof(double), cudaMemcpyDeviceToDevice);   if(cudaStatus != cudaSuccess) { printf("Error53: %s\n", cudaGetErrorString(cudaStatus)); cin >> dummyUserInput; }
          cudaThreadSynchronize();
       #else
-         for (int i = 0; i < 3*NN; i++) {
-            Un[i] = Unp1[i];
-         }
-
-         for (int i = 0; i < NNp; i++) {
-            Pn[i] = Pnp1[i];
+         if (innerPredictor == 1) {
+            vectorCopy(3*NN, Un, Unm1);
+            Unm1isSet = 1;
          }
+         swap = Un;   Un = Unp1;   Unp1 = swap;
+         swap = Pn;   Pn = Pnp1;   Pnp1 = swap;
       #endif
       
       
@@ -3092,6 +3449,14 @@ void timeLoop()
                 timeN, iter, timeT, Un[monPoint],
                 Un[NN+monPoint], Un[2*NN+monPoint], Pn[monPoint], wallClockTimeCurrentTimeStep, maxAcc);
       #endif      
+
+      #if defined(COUNT_ALLOCATIONS) && !defined(USECUDA)
+         if (nHeapAllocations != nAllocationsAtStepStart) {
+            printf("ERROR: %ld heap allocations are made in time step %d.\n", (long)nHeapAllocations - nAllocationsAtStepStart, timeN);
+            fflush(stdout);
+            abort();
+         }
+      #endif
       
       
       if (checkAccConvergence == 1) {
@@ -3117,6 +3482,11 @@ void timeLoop()
       
    }  // End of while loop for time
 
+   if (nPressureSolves > 0) {
+      printf("\nPressure solver: %d solves, %ld iterations (%.1f per solve), %.3f seconds in total.\n",
+             nPressureSolves, nPressureIterations, (double)nPressureIterations / nPressureSolves, pressureSolveTime);
+   }
+
 }  // End of function timeLoop()
 
 
@@ -3293,6 +3663,7 @@ void step0()
    for (int i = 0; i < 3*NN; i++) {
       MdInv[i] = 1.0 / Md[i];
    }
+   applyBC_Step1(2);
 
    // CONTROL
    //for (int i = 0; i < 3*NN; i++) {
@@ -3302,8 +3673,93 @@ void step0()
    #ifdef USECUDA
       calculateZ_CUSP();   // Calculate Z using the CUSP library
    #else
-      calculateZ();        // Calculate Z using the CSparse library
-      extractUpperTriangularPartOfZ();
+      if (pressureSolver < 0 || pressureSolver > 4) {
+         printf("ERROR: Unknown pressure solver %d.\n", pressureSolver);
+         printf("Native PCG will be used instead.\n");
+         pressureSolver = 1;
+      }
+      if (pressureCGVariant < 0 || pressureCGVariant > 2) {
+         printf("ERROR: Unknown CG variant %d.\n", pressureCGVariant);
+         printf("Standard PCG will be used instead.\n");
+         pressureCGVariant = 0;
+      }
+      if (pressureOperator < 0 || pressureOperator > 1) {
+         printf("ERROR: Unknown pressure operator %d.\n", pressureOperator);
+         printf("Gt*inv(Md)*G will be used instead.\n");
+         pressureOperator = 0;
+      }
+      if (pressureSolver == 2) {   // Iterations of none, Jacobi and additive Schwarz diverge without CG
+         int p = pressurePreconditioner;
+         if (p != 2 && p != 3 && p != 4 && p != 5 && p != 6 && p != 8) {
+            printf("Preconditioner iterations diverge with pressure preconditioner %d. Native PCG will be used instead.\n", p);
+            pressureSolver = 1;
+         }
+      }
+      if (pressureNullSpace == 1 && pressureSolver == 3) {
+         printf("Sparse Cholesky factorization needs a nonsingular [Z]. zeroPressureNode is eliminated instead.\n");
+         pressureNullSpace = 2;
+      }
+      if (pressureOperator == 1 && NENp == 1) {
+         printf("Q1 pressure Laplacian needs pressure at the element corners. Gt*inv(Md)*G will be used instead.\n");
+         pressureOperator = 0;
+      }
+      if (pressureOperator == 1 && pressureMatrixFree) {
+         printf("Q1 pressure Laplacian is assembled. pressureMatrixFree is ignored.\n");
+         pressureMatrixFree = 0;
+      }
+      if (pressureMatrixFree) {   // Only PCG with Jacobi or no preconditioner needs nothing but products with [Z]
+         if (pressureSolver != 1) {
+            printf("Pressure solver %d cannot be used with matrix-free [Z]. Native PCG will be used instead.\n", pressureSolver);
+            pressureSolver = 1;
+         }
+         if (pressureCGVariant != 0) {
+            printf("Only the standard PCG can be used with matrix-free [Z].\n");
+            pressureCGVariant = 0;
+         }
+      }
+      setupInterleavedG(); // G and its transpose in the form used by the time loop and by calculateZ()
+      if (pressureMatrixFree) {
+         setupMatrixFreeZ();  // Diagonal of Z only
+      } else {
+         if (pressureOperator == 1) {
+            calculateZLaplacian();  // Upper triangle of the Q1 Laplacian, used in place of Z
+         } else {
+            calculateZ();           // Upper triangle of Z by a direct triple product
+         }
+         setupZStorage();     // Forms of Z used by the solvers
+      }
+
+      if (pressureSolver != 0) {   // Pressure nodes are the corner nodes, i.e. the first NNp nodes.
+         setChebyshevDegree(pressureChebyshevDegree);
+         setFSAIPattern(pressureFSAIPattern);
+         setPressureNullSpaceProjection(pressureNullSpace == 1 && pressureHasNullSpace);
+         if (pressureMatrixFree) {
+            setPressureOperator(NNp, multiplyZMatrixFree, Z_diagonal);
+         }
+         if (!setupPressureSolver(NNp, Z_rowStarts, Z_col, Z_value, pressurePreconditioner, coord)) {
+            printf("Jacobi preconditioner will be used instead.\n");
+            pressurePreconditioner = 1;
+            setupPressureSolver(NNp, Z_rowStarts, Z_col, Z_value, pressurePreconditioner, coord);
+         }
+         setupPressureCGVariant(pressureCGVariant, pressureCGSteps);
+         if (pressureRecycleVectors > 0) {
+            setupPressureRecycling(pressureRecycleVectors, pressureRecycleSolves);
+         }
+      }
+      if (pressureSolver == 4) {
+         setupPressureMixedPrecision();
+      }
+      if (pressureSolver == 3) {   // PCG, which is set up above, is the fall back
+         if (!setupPressureCholesky(NNp, Z_rowStarts, Z_col, Z_value, coord)) {
+            printf("Native PCG will be used instead.\n");
+            pressureSolver = 1;
+         }
+      }
+      if (!setupPressureInitialGuess(NNp, Z_rowStarts, Z_col, Z_value, pressureInitialGuess, pressureProjectionWindow)) {
+         printf("Projection onto the previous solutions will be used instead.\n");
+         pressureInitialGuess = 2;
+         setupPressureInitialGuess(NNp, Z_rowStarts, Z_col, Z_value, pressureInitialGuess, pressureProjectionWindow);
+      }
    #endif
    
    #ifdef USECUDA
@@ -3322,195 +3778,527 @@ void step0()
 void calculateZ()
 //========================================================================
 {
-   // Use Timothy Davis' CSparse package to calculate the Z matrix.
+   // Calculates the upper triangle of [Z] = sum_d transpose(Gd) * inv(Md) * Gd,
+   // d = 1, 2, 3, directly from the interleaved G and its transpose (see
+   // setupInterleavedG()), in sorted CSR format with 0-based indices. Row i
+   // of [Z] is
+   //    Z(i,j) = sum_k sum_d Gd(k,i) * MdOrigInv[k] * Gd(k,j)
+   // where k runs over the velocity nodes of row i of Gt, and j over the
+   // pressure nodes of row k of G. Rows are independent and are calculated in
+   // parallel, first to count their nonzeros and then to fill them. Each
+   // thread accumulates a row in a dense array of size NNp.
+   // setupZStorage() later makes the other forms of [Z] that are needed.
+
+   Z_rowStartsUpper = new int[NNp+1];
+   Z_rowStartsUpper[0] = 0;
+
+   // Symbolic part. Number of nonzeros of row i is stored at i+1.
+   #pragma omp parallel
+   {
+      int *marker = new int[NNp];
+      for (int j = 0; j < NNp; j++) {
+         marker[j] = -1;
+      }
 
-   // Create colStarts array for the G matrix.
-   /*
-   int *sparseGcolStarts;
-   sparseGcolStarts = new int[NNp+1];
-   for (int i = 0; i < NNp+1; i++) {
-      sparseGcolStarts[i] = 0;
-   }
-   
-   for (int i = 0; i < sparseG_NNZ; i++) {   // Find the number of nonzeros entries in each column, but store values for the next column, i.e. number of nozeros of column c is stored to entry c+1.
-      sparseGcolStarts[sparseGcol[i] + 1] += 1;
-   }
-   
-   for (int i = 1; i < NNp+1; i++) {         // Add the nonzero entries in each column properly to determine colStarts
-      sparseGcolStarts[i] = sparseGcolStarts[i] + sparseGcolStarts[i - 1];
+      #pragma omp for schedule(dynamic, 64)
+      for (int i = 0; i < NNp; i++) {
+         int count = 0;
+         for (int kk = sparseGtRowStarts[i]; kk < sparseGtRowStarts[i+1]; kk++) {
+            int k = sparseGtCol[kk];
+            for (int jj = sparseGrowStarts[k]; jj < sparseGrowStarts[k+1]; jj++) {
+               int j = sparseGcol[jj];
+               if (j >= i && marker[j] != i) {
+                  marker[j] = i;
+                  count++;
+               }
+            }
+         }
+         Z_rowStartsUpper[i+1] = count;
+      }
+
+      delete[] marker;
    }
 
-   // CONTROL
-   //cout << endl << "NNp+1 entry of sparseGcolStarts = " << sparseGcolStarts[NNp] << endl;
-   */
+   for (int i = 0; i < NNp; i++) {
+      Z_rowStartsUpper[i+1] += Z_rowStartsUpper[i];
+   }
+   Z_NNZupper = Z_rowStartsUpper[NNp];
 
-   waitForUser("OK1. Enter a character... ");
+   Z_colIndicesUpper = new int[Z_NNZupper];
+   Z_valuesUpper     = new double[Z_NNZupper];
 
-   G1_cs = cs_spalloc(NN, NNp, sparseG_NNZ/3, 1, 1);   // See page 12 of Tim Davis' book.                                                            // TODO : 4. parametre olarak 0 veya 1 vermek birseyi degistirmiyor.
-   G1_cs->i = sparseGrow;                                                                                                                            //        To directly allocate this in CSC format we need column wise ordering info.
-   G1_cs->p = sparseGcol;
-   G1_cs->x = sparseG1value;
-   G1_cs->nz = sparseG_NNZ/3;
+   // Numeric part
+   #pragma omp parallel
+   {
+      int *marker = new int[NNp];
+      double *rowValue = new double[NNp];
+      for (int j = 0; j < NNp; j++) {
+         marker[j] = -1;
+      }
 
-   G3_cs = cs_spalloc(NN, NNp, sparseG_NNZ/3, 1, 1);
-   G3_cs->i = sparseGrow;
-   G3_cs->p = sparseGcol;
-   G3_cs->x = sparseG3value;
-   G3_cs->nz = sparseG_NNZ/3;
+      #pragma omp for schedule(dynamic, 64)
+      for (int i = 0; i < NNp; i++) {
+         int *cols = Z_colIndicesUpper + Z_rowStartsUpper[i];
+         int count = 0;
+         for (int kk = sparseGtRowStarts[i]; kk < sparseGtRowStarts[i+1]; kk++) {
+            int k = sparseGtCol[kk];
+            double m = MdOrigInv[k];
+            double g1 = sparseGtValue[3*kk]     * m;
+            double g2 = sparseGtValue[3*kk + 1] * m;
+            double g3 = sparseGtValue[3*kk + 2] * m;
+            for (int jj = sparseGrowStarts[k]; jj < sparseGrowStarts[k+1]; jj++) {
+               int j = sparseGcol[jj];
+               if (j < i) {
+                  continue;
+               }
+               double v = g1 * sparseGvalue[3*jj] + g2 * sparseGvalue[3*jj + 1] + g3 * sparseGvalue[3*jj + 2];
+               if (marker[j] != i) {
+                  marker[j] = i;
+                  rowValue[j] = v;
+                  cols[count++] = j;
+               } else {
+                  rowValue[j] += v;
+               }
+            }
+         }
 
-   G2_cs = cs_spalloc(NN, NNp, sparseG_NNZ/3, 1, 1);
-   G2_cs->i = sparseGrow;
-   G2_cs->p = sparseGcol;
-   G2_cs->x = sparseG2value;
-   G2_cs->nz = sparseG_NNZ/3;
+         sort(cols, cols + count);
+         double *values = Z_valuesUpper + Z_rowStartsUpper[i];
+         for (int c = 0; c < count; c++) {
+            values[c] = rowValue[cols[c]];
+         }
+      }
 
-   waitForUser("OK2. Enter a character... ");
+      delete[] marker;
+      delete[] rowValue;
+   }
 
-   G1_cs_CSC = cs_compress(G1_cs);             // Convert G1 from triplet format into compressed column format.
-   G2_cs_CSC = cs_compress(G2_cs);
-   G3_cs_CSC = cs_compress(G3_cs);
+   // Apply pressure BCs to [Z]
+   applyBC_Step2(1);
 
-   waitForUser("OK3. Enter a character... ");
+}  // End of function calculateZ()
 
-   G1t_cs_CSC = cs_transpose(G1_cs_CSC, 1);    // Determine the transpose of G1 in compressed column format.
-   G2t_cs_CSC = cs_transpose(G2_cs_CSC, 1);
-   G3t_cs_CSC = cs_transpose(G3_cs_CSC, 1);
 
-   //  CONTROL
-   //cs_print(G1_cs_CSC, 0);
-   //cs_print(G1t_cs_CSC, 0);
 
-   waitForUser("OK5. Enter a character... ");
 
-   // Use CSparse library to calculate [Z] = transpose(G) * inv(Md) * G
 
-   // First calculate dummy = inv(Md) * G1. It will have the same sparsity pattern with G, only the values will change.
-   double *dummyValues;
-   dummyValues = new double[sparseG_NNZ/3];
-   
+//========================================================================
+void calculateZLaplacian()
+//========================================================================
+{
+   // Used instead of calculateZ() when pressureOperator is 1. [Z] is the
+   // sum of the contributions Gd(k,:)^T * MdOrigInv[k] * Gd(k,:) of the
+   // velocity nodes k. The contributions of the nodes without velocity BCs
+   // are replaced by the Q1 Laplacian of the pressure shape functions
+   //    L(i,j) = 1/density^2 * integral( grad(Sp_i) . grad(Sp_j) )
+   // which is what they approximate for smooth pressure. This is the
+   // approximation allowed by the method of Blasco, Codina and Huerta. The
+   // contributions of the velocity BC nodes are kept as they are. Without
+   // them the operator would be singular while [Z] is not, and the pressure
+   // increments of the near constant modes would grow from one time step to
+   // the next. Rows of the interior pressure nodes couple only the nodes
+   // that share an element, 27 instead of 125 for hexahedra, so every CG
+   // iteration and every preconditioner setup is cheaper. It is stored in
+   // the same form as the output of calculateZ().
+
+   // Effect on accuracy: Pdot of step 2 is a pressure increment over the
+   // time step, recalculated at every inner iteration. With the approximate
+   // operator Za in place of [Z], the final velocity satisfies
+   // Gt * Unp1 = dt^2 * (Za - Z) * Pdot instead of Gt * Unp1 = 0. Both are
+   // consistent approximations of the Laplacian, so this divergence error is
+   // of order dt^2 * h^2 for smooth pressure and acts like a pressure
+   // stabilization term. It vanishes for steady solutions, where Pdot goes
+   // to zero, and is largest in fast transients. For strict mass
+   // conservation at every time step use pressureOperator = 0.
+
+   double factor = 1.0 / (density * density);
+
+   // Element matrices
+   double *Le = new double[NE * NENp * NENp];
+
+   #pragma omp parallel for schedule(static)
+   for (int e = 0; e < NE; e++) {
+      double *L = Le + e * NENp * NENp;
+      for (int a = 0; a < NENp; a++) {
+         for (int b = 0; b < NENp; b++) {
+            double sum = 0.0;
+            for (int k = 0; k < NGP; k++) {
+               sum += (gDSp[e][k][a][0] * gDSp[e][k][b][0] +
+                       gDSp[e][k][a][1] * gDSp[e][k][b][1] +
+                       gDSp[e][k][a][2] * gDSp[e][k][b][2]) * detJacob[e][k] * GQweight[k];
+            }
+            L[a*NENp + b] = factor * sum;
+         }
+      }
+   }
 
+   // Elements of each pressure node, in CSR form
+   int *nodeElemStarts = new int[NNp+1];
+   int *nodeElems      = new int[NE * NENp];
 
-   for (int i = 0; i < sparseG_NNZ/3; i++) {
-      dummyValues[i] = sparseG1value[i] * MdOrigInv[sparseGrow[i]];
+   for (int i = 0; i <= NNp; i++) {
+      nodeElemStarts[i] = 0;
+   }
+   for (int e = 0; e < NE; e++) {
+      for (int a = 0; a < NENp; a++) {
+         nodeElemStarts[LtoGpres[e][a] + 1]++;
+      }
+   }
+   for (int i = 0; i < NNp; i++) {
+      nodeElemStarts[i+1] += nodeElemStarts[i];
+   }
+   int *position = new int[NNp];
+   for (int i = 0; i < NNp; i++) {
+      position[i] = nodeElemStarts[i];
+   }
+   for (int e = 0; e < NE; e++) {
+      for (int a = 0; a < NENp; a++) {
+         nodeElems[position[LtoGpres[e][a]]++] = e;
+      }
    }
-   // Allocate the dummy matrix in CSparse triplet format
-   cs *dummy_cs;
-   dummy_cs = cs_spalloc(NN, NNp, sparseG_NNZ/3, 0, 1);                                                                                               // TODO : 4. parametre olarak 0 veya 1 vermek birseyi degistirmiyor.
-   dummy_cs->i = sparseGrow;
-   dummy_cs->p = sparseGcol;
-   dummy_cs->x = dummyValues;
-   dummy_cs->nz = sparseG_NNZ/3;
+   delete[] position;
 
-   // Convert dummy matrix from triplet format to CSC format
-   cs *dummy_cs_CSC;
-   dummy_cs_CSC = cs_compress(dummy_cs);
+   // Rows are formed as in calculateZ(), first to count their nonzeros and
+   // then to fill them. Velocity BC nodes are the ones with zero MdInv.
+   Z_rowStartsUpper = new int[NNp+1];
+   Z_rowStartsUpper[0] = 0;
 
-   // Multiply transpose(G1) with the dummy matrix to get the 1st contribution to [Z].
-   Z_cs = cs_multiply(G1t_cs_CSC, dummy_cs_CSC);
+   #pragma omp parallel
+   {
+      int *marker = new int[NNp];
+      for (int j = 0; j < NNp; j++) {
+         marker[j] = -1;
+      }
 
+      #pragma omp for schedule(dynamic, 64)
+      for (int i = 0; i < NNp; i++) {
+         int count = 0;
+         for (int ee = nodeElemStarts[i]; ee < nodeElemStarts[i+1]; ee++) {
+            int e = nodeElems[ee];
+            for (int b = 0; b < NENp; b++) {
+               int j = LtoGpres[e][b];
+               if (j >= i && marker[j] != i) {
+                  marker[j] = i;
+                  count++;
+               }
+            }
+         }
+         for (int kk = sparseGtRowStarts[i]; kk < sparseGtRowStarts[i+1]; kk++) {
+            int k = sparseGtCol[kk];
+            if (MdInv[k] != 0.0) {
+               continue;
+            }
+            for (int jj = sparseGrowStarts[k]; jj < sparseGrowStarts[k+1]; jj++) {
+               int j = sparseGcol[jj];
+               if (j >= i && marker[j] != i) {
+                  marker[j] = i;
+                  count++;
+               }
+            }
+         }
+         Z_rowStartsUpper[i+1] = count;
+      }
 
+      delete[] marker;
+   }
 
-   for (int i = 0; i < sparseG_NNZ/3; i++) {
-      dummyValues[i] = sparseG2value[i] * MdOrigInv[sparseGrow[i]];
+   for (int i = 0; i < NNp; i++) {
+      Z_rowStartsUpper[i+1] += Z_rowStartsUpper[i];
    }
-   // Allocate the dummy matrix in CSparse triplet format
-   dummy_cs->x = dummyValues;
+   Z_NNZupper = Z_rowStartsUpper[NNp];
 
-   // Convert dummy matrix from triplet format to CSC format
-   dummy_cs_CSC = cs_compress(dummy_cs);
+   Z_colIndicesUpper = new int[Z_NNZupper];
+   Z_valuesUpper     = new double[Z_NNZupper];
 
-   // Multiply transpose(G2) with the dummy matrix to get the second contribution to [Z].
-   cs *dummyZ_cs;
-   dummyZ_cs = cs_multiply(G2t_cs_CSC, dummy_cs_CSC);
+   #pragma omp parallel
+   {
+      int *marker = new int[NNp];
+      double *rowValue = new double[NNp];
+      for (int j = 0; j < NNp; j++) {
+         marker[j] = -1;
+      }
 
-   // Add this dummyZ to the previously calculated Z
-   for(int i=0; i<Z_cs->nzmax; i++) {
-      Z_cs->x[i] = Z_cs->x[i] + dummyZ_cs->x[i];
-   }
+      #pragma omp for schedule(dynamic, 64)
+      for (int i = 0; i < NNp; i++) {
+         int *cols = Z_colIndicesUpper + Z_rowStartsUpper[i];
+         int count = 0;
+         for (int kk = sparseGtRowStarts[i]; kk < sparseGtRowStarts[i+1]; kk++) {
+            int k = sparseGtCol[kk];
+            if (MdInv[k] != 0.0) {
+               continue;
+            }
+            double m = MdOrigInv[k];
+            double g1 = sparseGtValue[3*kk]     * m;
+            double g2 = sparseGtValue[3*kk + 1] * m;
+            double g3 = sparseGtValue[3*kk + 2] * m;
+            for (int jj = sparseGrowStarts[k]; jj < sparseGrowStarts[k+1]; jj++) {
+               int j = sparseGcol[jj];
+               if (j < i) {
+                  continue;
+               }
+               double v = g1 * sparseGvalue[3*jj] + g2 * sparseGvalue[3*jj + 1] + g3 * sparseGvalue[3*jj + 2];
+               if (marker[j] != i) {
+                  marker[j] = i;
+                  rowValue[j] = v;
+                  cols[count++] = j;
+               } else {
+                  rowValue[j] += v;
+               }
+            }
+         }
+         for (int ee = nodeElemStarts[i]; ee < nodeElemStarts[i+1]; ee++) {
+            int e = nodeElems[ee];
+            int a = 0;
+            while (LtoGpres[e][a] != i) {
+               a++;
+            }
+            double *L = Le + (e * NENp + a) * NENp;
+            for (int b = 0; b < NENp; b++) {
+               int j = LtoGpres[e][b];
+               if (j < i) {
+                  continue;
+               }
+               if (marker[j] != i) {
+                  marker[j] = i;
+                  rowValue[j] = L[b];
+                  cols[count++] = j;
+               } else {
+                  rowValue[j] += L[b];
+               }
+            }
+         }
 
-   cs_spfree(dummyZ_cs);
+         sort(cols, cols + count);
+         double *values = Z_valuesUpper + Z_rowStartsUpper[i];
+         for (int c = 0; c < count; c++) {
+            values[c] = rowValue[cols[c]];
+         }
+      }
 
-   
-   
-   for (int i = 0; i < sparseG_NNZ/3; i++) {
-      dummyValues[i] = sparseG3value[i] * MdOrigInv[sparseGrow[i]];
+      delete[] marker;
+      delete[] rowValue;
    }
-   // Allocate the dummy matrix in CSparse triplet format
-   dummy_cs->x = dummyValues;
 
-   // Convert dummy matrix from triplet format to CSC format
-   dummy_cs_CSC = cs_compress(dummy_cs);
+   delete[] Le;
+   delete[] nodeElemStarts;
+   delete[] nodeElems;
 
-   // Multiply transpose(G3) with the dummy matrix to get the third contribution to [Z].
-   dummyZ_cs = cs_multiply(G3t_cs_CSC, dummy_cs_CSC);
+   // Apply pressure BCs to [Z]
+   applyBC_Step2(1);
+
+}  // End of function calculateZLaplacian()
 
-   // Add this dummyZ to the previously calculated Z
-   for(int i=0; i<Z_cs->nzmax; i++) {
-      Z_cs->x[i] = Z_cs->x[i] + dummyZ_cs->x[i];
-   }
-   cs_spfree(dummyZ_cs);
 
-   waitForUser("OK6. Enter a character... ");
-   
-   //cs_spfree(dummy_cs);    // If we delete this sparseGcol is also deleted, but we need it later.                                                   // TODO
-   delete[] dummyValues;
 
-   delete[] sparseGrow;
-   
-   cs_spfree(dummy_cs_CSC);
 
-   //cs_print(Z_cs, 0);
+
+//========================================================================
+void setupMatrixFreeZ()
+//========================================================================
+{
+   // Used instead of calculateZ() when pressureMatrixFree is 1. Only the
+   // diagonal of [Z] is calculated, which is what the Jacobi preconditioner
+   // needs. With the notation of calculateZ()
+   //    Z(i,i) = sum_k sum_d Gd(k,i)^2 * MdOrigInv[k]
+   // where k runs over the velocity nodes of row i of Gt. Products with [Z]
+   // are calculated by multiplyZMatrixFree().
+
+   Z_diagonal     = new double[NNp];
+   Z_work         = new double[3*NN];
+   Z_pinnedColumn = NULL;
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < NNp; i++) {
+      double sum = 0.0;
+      for (int kk = sparseGtRowStarts[i]; kk < sparseGtRowStarts[i+1]; kk++) {
+         double g1 = sparseGtValue[3*kk];
+         double g2 = sparseGtValue[3*kk + 1];
+         double g3 = sparseGtValue[3*kk + 2];
+         sum += (g1*g1 + g2*g2 + g3*g3) * MdOrigInv[sparseGtCol[kk]];
+      }
+      Z_diagonal[i] = sum;
+   }
 
    // Apply pressure BCs to [Z]
    applyBC_Step2(1);
 
-   waitForUser("OK7. Enter a character... ");
-   
-   // To use with MKL CG solver, compute the transpose of Z_cs and write it to a file.
-   // Since Z is a symmetric matrix taking its tranpose will not change it but will
-   // only sort its column indices.
-   Z_csSorted = cs_transpose(Z_cs, 1);
-      
-   // Deallocate memory
-   delete[] Md;
-   //delete[] MdOrigInv;
-   cs_spfree(Z_cs);
-                                                                                                                                                      // TODO : Free unncesary memory. Be careful abour CSparse varibles.
-}  // End of function calculateZ()
+}  // End of function setupMatrixFreeZ()
 
 
 
 
 
 //========================================================================
-void extractUpperTriangularPartOfZ()
+void multiplyZMatrixFree(double *p, double *y)
 //========================================================================
 {
-   // MKL CG solver needs only the upper triangle of the symmetric matrices.
-   // So let's find it for [Z]. Also it uses 1-based indexing.
+   // Calculates y = [Z] * p as Gt * (MdOrigInv * (G * p)) with two passes over
+   // G, without forming [Z]. Pressure BCs, which applyBC_Step2() applies to
+   // the stored [Z], are applied to the product here.
+
+   csrScaledGradient(NN, sparseGvalue, sparseGcol, sparseGrowStarts, p, MdOrigInv, Z_work);
+   csrDivergence(NNp, 1.0, sparseGtValue, sparseGtCol, sparseGtRowStarts, Z_work, 1, 3, 0.0, y);
+
+   int node = zeroPressureNode;
+
+   if (node > 0 && pressureNullSpace == 0) {
+      y[node] += Z_pinShift * p[node];
+   } else if (node > 0 && pressureNullSpace == 2 && Z_pinnedColumn != NULL) {
+      // Row and column "node" are zero except the diagonal
+      double pNode = p[node];
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < NNp; i++) {
+         y[i] -= Z_pinnedColumn[i] * pNode;
+      }
+      y[node] = Z_diagonal[node] * pNode;
+   }
 
-   Z_NNZupper = NNp + (Z_csSorted->nzmax - NNp) / 2;
-   
-   Z_rowStartsUpper  = new int[NNp+1];
-   Z_colIndicesUpper = new int[Z_NNZupper];
-   Z_valuesUpper     = new double[Z_NNZupper];
+}  // End of function multiplyZMatrixFree()
+
+
+
+
+
+//========================================================================
+void setupZStorage()
+//========================================================================
+{
+   // Makes the forms of [Z] that the solvers use from the upper triangle
+   // calculated by calculateZ().
+   //   Native solvers of pressureSolvers.cpp use all rows of [Z], with
+   //   0-based indices and sorted columns.
+   //   MKL CG solver uses the upper triangle with 1-based indices.
+
+   Z_NNZ = 2 * Z_NNZupper - NNp;
 
-   Z_rowStartsUpper[0] = 1;
+   Z_rowStarts = new int[NNp+1];
+   Z_col       = new int[Z_NNZ];
+   Z_value     = new double[Z_NNZ];
 
-   int counter = 0;  // Counter for the nonzeros on the upper half
+   // Row i has the upper triangle entries of row i and, to the left of the
+   // diagonal, the entries of column i of the upper triangle.
+   for (int i = 0; i <= NNp; i++) {
+      Z_rowStarts[i] = 0;
+   }
+   for (int i = 0; i < NNp; i++) {
+      for (int j = Z_rowStartsUpper[i]; j < Z_rowStartsUpper[i+1]; j++) {
+         Z_rowStarts[i+1]++;
+         if (Z_colIndicesUpper[j] != i) {
+            Z_rowStarts[Z_colIndicesUpper[j] + 1]++;
+         }
+      }
+   }
+   for (int i = 0; i < NNp; i++) {
+      Z_rowStarts[i+1] += Z_rowStarts[i];
+   }
 
-   for(int r = 0; r < NNp; r++) {  // Row loop
-      for(int c = Z_csSorted->p[r]; c < Z_csSorted->p[r+1]; c++) {  // Nonzero column loop
-         if(Z_csSorted->i[c] >= r) {  // These are on the upper half
-            Z_colIndicesUpper[counter] = Z_csSorted->i[c] + 1;
-            Z_valuesUpper[counter] = Z_csSorted->x[c];
-            counter++;
+   // Lower part first. Rows of the upper triangle are visited in ascending
+   // order, so these columns are sorted.
+   int *position = new int[NNp];
+   for (int i = 0; i < NNp; i++) {
+      position[i] = Z_rowStarts[i];
+   }
+   for (int i = 0; i < NNp; i++) {
+      for (int j = Z_rowStartsUpper[i]; j < Z_rowStartsUpper[i+1]; j++) {
+         int c = Z_colIndicesUpper[j];
+         if (c != i) {
+            int loc = position[c]++;
+            Z_col[loc]   = i;
+            Z_value[loc] = Z_valuesUpper[j];
          }
       }
-      Z_rowStartsUpper[r+1] = counter + 1;
    }
-                                                                                                                                                      // TODO : Free unncesary memory. Be careful abour CSparse varibles.
-} // End of function extractUpperTriangularPartOfZ()
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < NNp; i++) {
+      int loc = position[i];
+      for (int j = Z_rowStartsUpper[i]; j < Z_rowStartsUpper[i+1]; j++) {
+         Z_col[loc]   = Z_colIndicesUpper[j];
+         Z_value[loc] = Z_valuesUpper[j];
+         loc++;
+      }
+   }
+   delete[] position;
+
+   // Switch the upper triangle to 1-based indices
+   for (int i = 0; i <= NNp; i++) {
+      Z_rowStartsUpper[i]++;
+   }
+   for (int j = 0; j < Z_NNZupper; j++) {
+      Z_colIndicesUpper[j]++;
+   }
+
+}  // End of function setupZStorage()
+
+
+
+
+
+//========================================================================
+void setupInterleavedG()
+//========================================================================
+{
+   // G1, G2 and G3 share the same sparsity pattern. Store them as a single
+   // matrix whose nonzeros carry three values each, so that the gradient
+   // (G * p) can be calculated in one pass over the column indices. Also
+   // store the transpose of this matrix explicitly, so that the divergence
+   // (Gt * u) can be calculated row by row without scattered writes.
+
+   int nnzG = sparseG_NNZ / 3;
+
+   sparseGvalue = new double[3*nnzG];
+
+   for (int i = 0; i < nnzG; i++) {
+      sparseGvalue[3*i]     = sparseG1value[i];
+      sparseGvalue[3*i + 1] = sparseG2value[i];
+      sparseGvalue[3*i + 2] = sparseG3value[i];
+   }
+
+   // Transpose of G. Count the nonzeros in each column of G, which are the rows of Gt.
+   sparseGtRowStarts = new int[NNp+1];
+   sparseGtCol       = new int[nnzG];
+   sparseGtValue     = new double[3*nnzG];
+
+   for (int i = 0; i < NNp+1; i++) {
+      sparseGtRowStarts[i] = 0;
+   }
+
+   for (int i = 0; i < nnzG; i++) {
+      sparseGtRowStarts[sparseGcol[i] + 1]++;
+   }
+
+   for (int i = 0; i < NNp; i++) {
+      sparseGtRowStarts[i+1] += sparseGtRowStarts[i];
+   }
+
+   // Fill the rows of Gt. Since rows of G are visited in ascending order, the
+   // column indices of each row of Gt are also sorted.
+   int *position;   // Next free location in each row of Gt
+   position = new int[NNp];
+   for (int i = 0; i < NNp; i++) {
+      position[i] = sparseGtRowStarts[i];
+   }
+
+   for (int r = 0; r < NN; r++) {
+      for (int j = sparseGrowStarts[r]; j < sparseGrowStarts[r+1]; j++) {
+         int loc = position[sparseGcol[j]]++;
+         sparseGtCol[loc] = r;
+         sparseGtValue[3*loc]     = sparseGvalue[3*j];
+         sparseGtValue[3*loc + 1] = sparseGvalue[3*j + 1];
+         sparseGtValue[3*loc + 2] = sparseGvalue[3*j + 2];
+      }
+   }
+
+   delete[] position;
+
+   // Separate value arrays are no longer necessary on the CPU.
+   delete[] sparseG1value;
+   delete[] sparseG2value;
+   delete[] sparseG3value;
+   sparseG1value = NULL;
+   sparseG2value = NULL;
+   sparseG3value = NULL;
+
+} // End of function setupInterleavedG()
 
 
 
@@ -3531,7 +4319,7 @@ void calculateMatrixA()
    double u0, v0, w0;
    double *R1ue, *R1ve, *R1we; 
    
-   double **Ae_11;
+   double *Ae_11;            // Stored row by row, i.e. Ae_11[i*NENv + j]
    double GQfactor;
 
    for (int i = 0; i < sparseM_NNZ/3; i++){
@@ -3553,33 +4341,30 @@ void calculateMatrixA()
       //cout << "offset_" << NmeshColors[color] << " = " << offsetElements << endl;
       #pragma omp parallel private(Ae_11, R1ue, R1ve, R1we, u0, v0, w0, u0_nodal, v0_nodal, w0_nodal, uPrev_nodal, vPrev_nodal, wPrev_nodal, GQfactor) shared(NmeshColors, Sv, NENv, NGP, offsetElements)
       {   
+         // Elemental arrays are taken from this thread's part of the workspace.
+         double *scratch = workspace.elementScratch + omp_get_thread_num() * workspace.elementScratchSize;
+
+         u0_nodal = scratch;
+         v0_nodal = scratch + NENv;
+         w0_nodal = scratch + 2*NENv;
          
-         u0_nodal = new double[NENv];
-         v0_nodal = new double[NENv];
-         w0_nodal = new double[NENv];
-         
-         uPrev_nodal = new double[NENv];
-         vPrev_nodal = new double[NENv];
-         wPrev_nodal = new double[NENv];
-         
-         Ae_11 = new double*[NENv];
-         for (int i = 0; i < NENv; i++) {
-            Ae_11[i] = new double[NENv];
-         }
+         uPrev_nodal = scratch + 3*NENv;
+         vPrev_nodal = scratch + 4*NENv;
+         wPrev_nodal = scratch + 5*NENv;
          
-         R1ue = new double[NENv];
-         R1ve = new double[NENv];
-         R1we = new double[NENv];                  
+         R1ue = scratch + 6*NENv;
+         R1ve = scratch + 7*NENv;
+         R1we = scratch + 8*NENv;
+
+         Ae_11 = scratch + 9*NENv;
          
          #pragma omp for 
             for (int eCount = 0; eCount < NmeshColors[color]; eCount++) {
                
                int e = elementsOfColor[offsetElements + eCount]; // Element that particular thread works on 
                
-               for (int i = 0; i < NENv; i++) {
-                  for (int j = 0; j < NENv; j++) {
-                     Ae_11[i][j] = 0.0;
-                  }
+               for (int i = 0; i < NENv*NENv; i++) {
+                  Ae_11[i] = 0.0;
                }
                
                for (int i = 0; i<NENv; i++) {
@@ -3623,7 +4408,7 @@ void calculateMatrixA()
                 
                   for (int i = 0; i < NENv; i++) {
                      for (int j = 0; j < NENv; j++) {
-                        Ae_11[i][j] = Ae_11[i][j] + (u0 * gDSv[e][k][j][0] + v0 * gDSv[e][k][j][1] + w0 * gDSv[e][k][j][2]) * Sv[k][i] * GQfactor;
+                        Ae_11[i*NENv + j] = Ae_11[i*NENv + j] + (u0 * gDSv[e][k][j][0] + v0 * gDSv[e][k][j][1] + w0 * gDSv[e][k][j][2]) * Sv[k][i] * GQfactor;
                      }
                   }       
                } // GQ loop
@@ -3631,7 +4416,7 @@ void calculateMatrixA()
                // if (e==0){
                   // for (int i = 0; i < NENv; i++) {
                      // for (int j = 0; j < NENv; j++) {
-                        // cout << i << "  " << j << "  " << Ae_11[i][j] << endl;   // Assemble upper left sub-matrix of A
+                        // cout << i << "  " << j << "  " << Ae_11[i*NENv + j] << endl;   // Assemble upper left sub-matrix of A
                      // }
                   // }         
                // }
@@ -3639,9 +4424,9 @@ void calculateMatrixA()
                // Assemble R1e.
                for (int i = 0; i < NENv; i++) {
                   for (int j = 0; j < NENv; j++) {
-                     R1ue[i] += Ae_11[i][j] * uPrev_nodal[j];
-                     R1ve[i] += Ae_11[i][j] * vPrev_nodal[j];
-                     R1we[i] += Ae_11[i][j] * wPrev_nodal[j];
+                     R1ue[i] += Ae_11[i*NENv + j] * uPrev_nodal[j];
+                     R1ve[i] += Ae_11[i*NENv + j] * vPrev_nodal[j];
+                     R1we[i] += Ae_11[i*NENv + j] * wPrev_nodal[j];
                   }
                }
                
@@ -3656,21 +4441,6 @@ void calculateMatrixA()
                
             } // End of element loop, end of #pragma for
             
-         for (int i = 0; i < NENv; i++) {
-            delete[] Ae_11[i];
-         }
-         delete[] Ae_11; 
-         
-         delete[] u0_nodal;
-         delete[] v0_nodal;
-         delete[] w0_nodal;
-         delete[] uPrev_nodal;
-         delete[] vPrev_nodal;
-         delete[] wPrev_nodal;
-         delete[] R1ue;
-         delete[] R1ve;
-         delete[] R1we;                       
-            
       } // End of #pragma parallel
                                                                  
       offsetElements += NmeshColors[color];
@@ -3717,70 +4487,27 @@ void step1(int iter)
       step1GPUpart(iter);
       cudaThreadSynchronize();
    #else
-      char transa, matdescra[6];
-      double alpha = -1.0;
-      double beta;
-      int m = NN;
-      int k = NNp;
-
-      transa = 'n';
-   
-      matdescra[0] = 'g';
-      matdescra[1] = 'u';
-      matdescra[2] = 'n';
-      matdescra[3] = 'c';
-   
-      double *UnpHalf_prev1, *UnpHalf_prev2, *UnpHalf_prev3;
-      
-      UnpHalf_prev1 = new double[NN];
-      UnpHalf_prev2 = new double[NN];
-      UnpHalf_prev3 = new double[NN];
-      
-      for (int i = 0; i < NN; i++) {
-         UnpHalf_prev1[i] = UnpHalf_prev[i];
-         UnpHalf_prev2[i] = UnpHalf_prev[i + NN];
-         UnpHalf_prev3[i] = UnpHalf_prev[i + 2*NN];
-      }
-
-      beta = 1.0;
-      mkl_dcsrmv(&transa, &m, &m, &alpha, matdescra, sparseKvalue, sparseMcol, sparseMrowStarts, sparseMrowStartsMod, UnpHalf_prev1, &beta, R11);   // This contributes to (- K * UnpHalf_prev)  part of R1
-      mkl_dcsrmv(&transa, &m, &m, &alpha, matdescra, sparseKvalue, sparseMcol, sparseMrowStarts, sparseMrowStartsMod, UnpHalf_prev2, &beta, R12);   // This contributes to (- K * UnpHalf_prev)  part of R2
-      mkl_dcsrmv(&transa, &m, &m, &alpha, matdescra, sparseKvalue, sparseMcol, sparseMrowStarts, sparseMrowStartsMod, UnpHalf_prev3, &beta, R13);   // This contributes to (- K * UnpHalf_prev)  part of R3
+      // Add (- K * UnpHalf_prev) to R1. u, v and w parts are handled in a single
+      // pass over [K].
+      csrMultiply3(NN, -1.0, sparseKvalue, sparseMcol, sparseMrowStarts, UnpHalf_prev, NN, 1, 1.0, R1, NN, 1);
 
       // CONTROL
       //for (int i = 0; i < NN; i++) {
       //   cout << i << "   " << R11[i] << endl;
       //}
 
-      beta = 1.0;   // To add R11, R12, R13 to the previosuly calculated ones.
-      mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG1value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, Pn, &beta, R11);             // This contributes to (- G * Pn)  part of R1
-      mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG2value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, Pn, &beta, R12);             // This contributes to (- G * Pn)  part of R2
-      mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG3value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, Pn, &beta, R13);             // This contributes to (- G * Pn)  part of R3
-   
+      // Add (- G * Pn) to R1. All three parts of [G] are handled in a single pass.
+      csrGradient(NN, -1.0, sparseGvalue, sparseGcol, sparseGrowStarts, Pn, 1.0, R1, NN, 1);
 
-      for (int i = 0; i < NN; i++) {
-         R1[i]        = R11[i];
-         R1[i + NN]   = R12[i];
-         R1[i + 2*NN] = R13[i];
-      }
 
       // CONTROL
       //for (int i = 0; i < 3*NN; i++) {
       //   cout << i << "   " << R1[i] << endl;
       //}
 
-      // Modify R1 for velocity BCs
-      applyBC_Step1(2);
-
-      // CONTROL
-      //for (int i = 0; i < 3*NN; i++) {
-      //   cout << i << "   " << R1[i] << endl;
-      //}
-   
-      // Calculate UnpHalf
-      for (int i=0; i<3*NN; i++) {
-         UnpHalf[i] = Un[i] + dt * R1[i] * MdInv[i];
-      }
+      // Calculate UnpHalf. R1 is not modified for velocity BCs, because MdInv
+      // is zero at velocity BC nodes (see applyBC_Step1()).
+      vectorUpdate(3*NN, UnpHalf, 1.0, Un, dt, R1, MdInv);
 
       // CONTROL
       //for (int i=0; i<3*NN; i++) {
@@ -3788,10 +4515,6 @@ void step1(int iter)
       //}
       // CONTROL     
 
-      delete[] UnpHalf_prev1;
-      delete[] UnpHalf_prev2;
-      delete[] UnpHalf_prev3;
-      
    #endif  // USECUDA
    
    
@@ -3816,19 +4539,15 @@ void step2(int iter)
    
    
    double *dummy;
-   dummy = new double[3*NN];    // Stores (UnpHalf / (dt*dt) * MdOrigInv * K * Acc_prev)
+   dummy = workspace.step2RHS;  // Stores (UnpHalf / (dt*dt) * MdOrigInv * K * Acc_prev)
    
    double oneOverdt2 = 1.0000000000000000 / (dt*dt);
-   for (int i=0; i<3*NN; i++) {
-      dummy[i] = oneOverdt2 * UnpHalf[i];
-   }
 
-   
    // Subtract MdOrigInv * K * Acc_prev from UnpHalf
-   if (iter != 1) {   // KtimesAcc_prev = 0. So skip this part
-      for (int i = 0; i < 3*NN; i++) {
-         dummy[i] = dummy[i] - MdOrigInv[i] * KtimesAcc_prev[i];
-      }
+   if (iter != 1 || accCarriedOver) {
+      vectorUpdate(3*NN, dummy, oneOverdt2, UnpHalf, -1.0, MdOrigInv, KtimesAcc_prev);
+   } else {           // KtimesAcc_prev = 0. So skip this part
+      vectorUpdate(3*NN, dummy, oneOverdt2, UnpHalf, 0.0, NULL, NULL);
    }
    
 
@@ -3838,34 +4557,8 @@ void step2(int iter)
    //}
    
    
-   char transa, matdescra[6];
-   double alpha, beta;
-   int m = NN;
-   int k = NNp;
-
-   matdescra[0] = 'g';
-   matdescra[1] = 'u';
-   matdescra[2] = 'n';  
-   matdescra[3] = 'c';
-
-   alpha = 1.0;
-   transa = 't';    // Multiply using Gt, not G
-      
-   double *dummy1, *dummy2, *dummy3;
-   dummy1 = new double[NN];
-   dummy2 = new double[NN];
-   dummy3 = new double[NN];
-   for (int i = 0; i < NN; i++) {
-      dummy1[i] = dummy[i];
-      dummy2[i] = dummy[i + NN];
-      dummy3[i] = dummy[i + 2*NN];
-   }
-
-   beta = 0.0;
-   mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG1value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, dummy1, &beta, R2);   // This contributes to (Gt * dummyR2) which is R2
-   beta = 1.0;   // Add the results of the following Matrix-vector multiplication to R2
-   mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG2value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, dummy2, &beta, R2);   // This contributes to (Gt * dummyR2) which is R2
-   mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG3value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, dummy3, &beta, R2);   // This contributes to (Gt * dummyR2) which is R2
+   // R2 = Gt * dummy. All three parts of [G] are handled in a single pass.
+   csrDivergence(NNp, 1.0, sparseGtValue, sparseGtCol, sparseGtRowStarts, dummy, NN, 1, 0.0, R2);
 
    // CONTROL
    //for (int i=0; i<NNp; i++) {
@@ -3877,8 +4570,15 @@ void step2(int iter)
    applyBC_Step2(2);
 
    
-   // Solve for Pdot using MKL's CG solver.
-   MKL_CG_solver(iter);
+   // Solve for Pdot.
+   if (pressureSolver == 0) {
+      MKL_CG_solver(iter);
+   } else {
+      nativePressureSolver(iter);
+   }
+
+   // Set the level of Pdot if [Z] is singular.
+   applyBC_Step2(3);
 
 
    // CONTROL
@@ -3888,20 +4588,13 @@ void step2(int iter)
 
 
    // Calculate Pnp1
-   for (int i = 0; i < NNp; i++) {
-      Pnp1[i] = Pn[i] + dt * Pdot[i];
-   }
+   vectorUpdate(NNp, Pnp1, 1.0, Pn, dt, Pdot, NULL);
    
    // CONTROL
    //for (int i=0; i<NNp; i++) {
    //   cout << Pnp1[i] << endl;
    //}
 
-   delete[] dummy;
-   delete[] dummy1;
-   delete[] dummy2;
-   delete[] dummy3;
-
 }  // End of function step2()
 
 
@@ -3914,64 +4607,282 @@ void step3(int iter)
 {
    // Executes step 3 of the method to determine the velocity of the new time step.
 
-   // Calculate the RHS vector of step 3.
-   // R3 = - dt * (G * Pdot + K * Acc_prev)
+   // Calculate the RHS vector of step 3, R3 = - dt * (G * Pdot + K * Acc_prev),
+   // and use it to get Acc = R3 * MdInv and Unp1 = UnpHalf + dt * Acc. All
+   // these are done in a single pass over the velocity nodes. Velocity BCs are
+   // satisfied through the zero entries of MdInv. Norms that are necessary for
+   // the convergence check of timeLoop() are calculated on the way.
 
-   char transa, matdescra[6];
-   double alpha = -dt;
-   double beta = 0.0;
-   int m = NN;
-   int k = NNp;
+   double *KAcc = KtimesAcc_prev;
+   if (iter == 1 && !accCarriedOver) {   // If iter = 1, KtimesAcc_prev = 0, so we can skip this part
+      KAcc = NULL;
+   }
 
-   transa = 'n';
-   
-   matdescra[0] = 'g';
-   matdescra[1] = 'u';
-   matdescra[2] = 'n';
-   matdescra[3] = 'c';
-   
-   mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG1value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, Pdot, &beta, R31);            // This contributes to (- dt * G1 * Pdot)  part of R3
-   mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG2value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, Pdot, &beta, R32);            // This contributes to (- dt * G2 * Pdot)  part of R3
-   mkl_dcsrmv(&transa, &m, &k, &alpha, matdescra, sparseG3value, sparseGcol, sparseGrowStarts, sparseGrowStartsMod, Pdot, &beta, R33);            // This contributes to (- dt * G3 * Pdot)  part of R3
+   step3FusedUpdate(NN, dt, sparseGvalue, sparseGcol, sparseGrowStarts, Pdot, KAcc, MdInv,
+                    UnpHalf, Unp1_prev, Acc, Unp1, &Unp1NormSqr, &Unp1DiffNormSqr);
 
-   for (int i = 0; i < NN; i++) {
-      R3[i]        = R31[i];
-      R3[i + NN]   = R32[i];
-      R3[i + 2*NN] = R33[i];
+   // CONTROL
+   //for (int i=0; i<3*NN; i++) {
+   //   cout << Unp1[i] << endl;
+   //}
+
+}  // End of function step3()
+
+
+
+
+
+//========================================================================
+void setupAnderson()
+//========================================================================
+{
+   // Allocates the vectors and the small dense arrays of andersonUpdate().
+
+   int n = 6*NN;
+   int m = andersonWindow;
+
+   andersonX     = new double[n];
+   andersonF     = new double[n];
+   andersonG     = new double[n];
+   andersonFprev = new double[n];
+   andersonGprev = new double[n];
+
+   andersonDF = new double*[m];
+   andersonDG = new double*[m];
+   for (int j = 0; j < m; j++) {
+      andersonDF[j] = new double[n];
+      andersonDG[j] = new double[n];
    }
 
+   andersonGram  = new double[m*m];
+   andersonL     = new double[m*m];
+   andersonGamma = new double[2*m];
 
-   if (iter != 1) {   // If iter = 1, KtimesAcc_prev = 0, so we can skip this part
-      for (int i = 0; i < 3*NN; i++) {
-         R3[i] = R3[i] - dt * KtimesAcc_prev[i];
+   printf("Inner iterations use Anderson acceleration with a window of %d.\n", m);
+
+}  // End of function setupAnderson()
+
+
+
+
+
+//========================================================================
+void andersonStart()
+//========================================================================
+{
+   // Called at the start of each time step, when UnpHalf_prev and Acc_prev
+   // hold the input of the first inner iteration. Stores that input and
+   // empties the stored differences of andersonUpdate().
+
+   int n3 = 3*NN;
+
+   vectorCopy(n3, UnpHalf_prev, andersonX);
+   if (accCarriedOver) {
+      vectorUpdate(n3, andersonX + n3, dt, Acc_prev, 0.0, NULL, NULL);
+   } else {
+      vectorSet(n3, 0.0, andersonX + n3);
+   }
+   andersonNstored = 0;
+   andersonNext = 0;
+
+}  // End of function andersonStart()
+
+
+
+
+
+//========================================================================
+void andersonUpdate(int iter)
+//========================================================================
+{
+   // Inner iterations of a time step are the fixed-point iteration
+   // x_k+1 = F(x_k) with x = [UnpHalf_prev; dt * Acc_prev], which is all that
+   // steps 1 to 3 read of the previous iteration (Pnp1_prev is used only in
+   // the convergence check). Acceleration is scaled with dt so that both
+   // parts are velocities. Called after iteration iter, when UnpHalf_prev and
+   // Acc_prev hold its output F(x_k), it replaces them with the Anderson
+   // (type II) update
+   //    x_k+1 = F(x_k) - sum_j gamma_j * DG_j
+   // where gamma minimizes || f_k - sum_j gamma_j * DF_j ||, f = F(x) - x, and
+   // DF_j, DG_j are the differences of successive residuals and outputs of
+   // the last andersonWindow iterations. The small least squares problem is
+   // solved with its regularized normal equations.
+
+   // Safeguards: If the residual grows, i.e. the previous update did not
+   // help, or if the coefficients cannot be calculated or are very large,
+   // the stored differences are dropped and x_k+1 = F(x_k), which is the plain
+   // fixed-point iteration. Storage starts empty at each time step (see
+   // andersonStart()).
+
+   const double MAX_COEFF_SUM = 10.0;   // Upper limit of sum |gamma_j|
+
+   int n3 = 3*NN;
+   int n = 6*NN;
+   int m = andersonWindow;
+
+   // Output of this iteration and its residual
+   double fNormSqr = 0.0;
+   #pragma omp parallel for simd schedule(static) reduction(+:fNormSqr)
+   for (int i = 0; i < n3; i++) {
+      double gU = UnpHalf_prev[i];
+      double gA = dt * Acc_prev[i];
+      double fU = gU - andersonX[i];
+      double fA = gA - andersonX[n3 + i];
+      andersonG[i]      = gU;
+      andersonG[n3 + i] = gA;
+      andersonF[i]      = fU;
+      andersonF[n3 + i] = fA;
+      fNormSqr += fU*fU + fA*fA;
+   }
+   double fNorm = sqrt(fNormSqr);
+
+   bool picard = false;
+
+   if (iter == 1) {
+      picard = true;
+   } else if (fNorm > andersonFnormPrev) {
+      andersonNstored = 0;   // Restart
+      picard = true;
+   } else {
+      // New column of the differences
+      int c = andersonNext;
+      double *DF = andersonDF[c];
+      double *DG = andersonDG[c];
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         DF[i] = andersonF[i] - andersonFprev[i];
+         DG[i] = andersonG[i] - andersonGprev[i];
+      }
+      andersonNext = (andersonNext + 1) % m;
+      andersonNstored = min(andersonNstored + 1, m);
+
+      // Column c of the Gram matrix. Others do not change.
+      for (int j = 0; j < andersonNstored; j++) {
+         double dot = vectorDot(n, andersonDF[j], DF);
+         andersonGram[j*m + c] = dot;
+         andersonGram[c*m + j] = dot;
+      }
+
+      // Normal equations (Gram + mu * I) gamma = DF^T f, solved by Cholesky
+      // factorization in a copy of the Gram matrix.
+      int k = andersonNstored;
+      double *L = andersonL;
+      double *rhs = andersonGamma + m;
+      double trace = 0.0;
+      for (int j = 0; j < k; j++) {
+         trace += andersonGram[j*m + j];
+         rhs[j] = vectorDot(n, andersonDF[j], andersonF);
+      }
+      double mu = 1e-10 * trace;
+
+      bool ok = (trace > 0.0);
+      for (int j = 0; j < k && ok; j++) {
+         for (int l = 0; l <= j; l++) {
+            double sum = andersonGram[j*m + l];
+            if (l == j) {
+               sum += mu;
+            }
+            for (int p = 0; p < l; p++) {
+               sum -= L[j*k + p] * L[l*k + p];
+            }
+            if (l == j) {
+               if (sum <= 0.0) {
+                  ok = false;
+                  break;
+               }
+               L[j*k + j] = sqrt(sum);
+            } else {
+               L[j*k + l] = sum / L[l*k + l];
+            }
+         }
+      }
+
+      double coeffSum = 0.0;
+      if (ok) {
+         double *gamma = andersonGamma;
+         for (int j = 0; j < k; j++) {   // Forward substitution
+            double sum = rhs[j];
+            for (int p = 0; p < j; p++) {
+               sum -= L[j*k + p] * gamma[p];
+            }
+            gamma[j] = sum / L[j*k + j];
+         }
+         for (int j = k-1; j >= 0; j--) {   // Back substitution
+            double sum = gamma[j];
+            for (int p = j+1; p < k; p++) {
+               sum -= L[p*k + j] * gamma[p];
+            }
+            gamma[j] = sum / L[j*k + j];
+            coeffSum += fabs(gamma[j]);
+         }
+      }
+
+      if (!ok || !(coeffSum <= MAX_COEFF_SUM)) {
+         andersonNstored = 0;   // Restart
+         picard = true;
       }
    }
 
-   // CONTROL
-   //for (int i=0; i<3*NN; i++) {
-   //   cout << R3[i] << endl;
-   //}
+   // Next input
+   if (picard) {
+      vectorCopy(n, andersonG, andersonX);
+   } else {
+      vectorCopy(n, andersonG, andersonX);
+      for (int j = 0; j < andersonNstored; j++) {
+         vectorUpdate(n, andersonX, 1.0, andersonX, -andersonGamma[j], andersonDG[j], NULL);
+      }
+      double oneOverdt = 1.0 / dt;
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n3; i++) {
+         UnpHalf_prev[i] = andersonX[i];
+         Acc_prev[i]     = andersonX[n3 + i] * oneOverdt;
+      }
+   }
+
+   if (andersonNstored == 0) {
+      andersonNext = 0;
+   }
 
+   // Current iteration becomes the previous one
+   swap(andersonF, andersonFprev);
+   swap(andersonG, andersonGprev);
+   andersonFnormPrev = fNorm;
 
-   // Modify R3 for velocity BCs
-   applyBC_Step3();
+}  // End of function andersonUpdate()
 
-   // Calculate Acc vector.
-   for (int i = 0; i < 3*NN; i++) {
-      Acc[i] = R3[i] * MdInv[i];
+
+
+
+
+//========================================================================
+double pressureSolveTolerance(int iter)
+//========================================================================
+{
+   // Returns the relative residual tolerance of the pressure solve of inner
+   // iteration iter of the current time step. With the adaptive policy, in
+   // the style of the forcing terms of Eisenstat and Walker, the tolerance is
+   // pressureAdaptiveFactor times the normalized change of the previous inner
+   // iteration, bounded by pressureToleranceMin and pressureToleranceMax. The
+   // first iteration of a time step uses the upper bound. The last allowed
+   // iteration, whose result is kept whether the loop converged or not, uses
+   // the lower bound. Pressure error of a loose solve is removed by the later
+   // iterations, so accuracy beyond the current change is not needed.
+
+   if (!pressureAdaptiveTolerance) {
+      return pressureTolerance;
    }
 
-   // Calculate Unp
-   for (int i = 0; i < 3*NN; i++) {
-      Unp1[i] = UnpHalf[i] + dt * Acc[i];
+   if (iter == maxIter) {
+      return pressureToleranceMin;
+   }
+   if (iter == 1 || lastOuterChange < 0.0) {
+      return pressureToleranceMax;
    }
 
-   // CONTROL
-   //for (int i=0; i<3*NN; i++) {
-   //   cout << Unp1[i] << endl;
-   //}
+   double tol = pressureAdaptiveFactor * lastOuterChange;
+   return min(pressureToleranceMax, max(pressureToleranceMin, tol));
 
-}  // End of function step3()
+}  // End of function pressureSolveTolerance()
 
 
 
@@ -3989,7 +4900,7 @@ void MKL_CG_solver(int iter)
 
    MKL_INT ipar[128];
    double dpar[128], *tmp;
-   tmp = new double[4*n];
+   tmp = workspace.CGtmp;       // Size is 4*n
    char tr = 'u';
    char matdes[3];
    double one = 1.000000000000000;
@@ -3998,10 +4909,10 @@ void MKL_CG_solver(int iter)
    matdes[1] = 'l';
    matdes[2] = 'n';
 
-   // Initialize the solution to zero
-   for (int i = 0; i < NNp; i++) {
-      Pdot[i] = 0.0;
-   }
+   double Start = getHighResolutionTime(1, 1.0);
+
+   // Initial guess from the previous solutions
+   initialPressureGuess(R2, Pdot);
 
    dcg_init (&n, Pdot, R2, &rci_request, ipar, dpar, tmp);
    if (rci_request != 0) {
@@ -4010,12 +4921,21 @@ void MKL_CG_solver(int iter)
       return;
    }
 
-   ipar[4] = 1000;    // Max. iteration number. Default is max(150,n)
+   ipar[4] = pressureMaxIter;   // Max. iteration number. Default is max(150,n)
    ipar[7] = 1;       // Perform iteration number based stopping check. Default is 1.
    ipar[8] = 1;       // Perform residual based stopping check. Default is 0.
    ipar[9] = 0;       // Do not perform user specified stopping check. Default is 1.
    ipar[10] = 1;      // Perform Jacobi Preconditioner
-   dpar[0] = 1e-12;   // Relative tolerance. Default is 1e-6.
+   // MKL's relative tolerance is relative to the initial residual, which is
+   // small with a good initial guess. To stop at ||r|| <= tol * ||R2||
+   // an absolute tolerance is used instead. Both are applied to squared norms.
+   double R2normSqr = 0.0;
+   for (int i = 0; i < NNp; i++) {
+      R2normSqr += R2[i] * R2[i];
+   }
+   dpar[0] = 0.0;                                                  // Relative tolerance. Default is 1e-6.
+   double tol = pressureSolveTolerance(iter);
+   dpar[1] = tol * tol * R2normSqr;                                // Absolute tolerance. Default is 0.
 
    int solverIter;
 
@@ -4030,7 +4950,11 @@ void MKL_CG_solver(int iter)
    if (rci_request == 0) {   // The solution is found with the required precision
       dcg_get (&n, Pdot, R2, &rci_request, ipar, dpar, tmp, &solverIter);
       if (PRINT_TIMES) cout << "MKL_CG converged after " << solverIter << " iterations." << endl;
+      nPressureSolves++;
+      nPressureIterations += solverIter;
       MKL_Free_Buffers();
+      savePressureSolution(Pdot);
+      pressureSolveTime += getHighResolutionTime(2, Start);
       goto out;
    } else if (rci_request == 1) { // Compute the vector A*tmp[0] and put the result in vector tmp[n]
       mkl_dcsrsymv (&tr, &n, Z_valuesUpper, Z_rowStartsUpper, Z_colIndicesUpper, tmp, &tmp[n]);
@@ -4050,7 +4974,7 @@ void MKL_CG_solver(int iter)
    //   cout << Pdot[i] << endl;
    //}
 
-   delete[] tmp;
+   return;   // tmp belongs to the workspace, nothing to deallocate.
 
 }  // End of function MKL_CG_solver()
 
@@ -4058,6 +4982,75 @@ void MKL_CG_solver(int iter)
 
 
 
+//========================================================================
+void nativePressureSolver(int iter)
+//========================================================================
+{
+   // Solve the system of step 2 [Z]{Pdot}={R2} using the solvers of
+   // pressureSolvers.cpp. Preconditioner, or the Cholesky factor of the
+   // direct solver, is set up in step0().
+
+   double Start = getHighResolutionTime(1, 1.0);
+
+   // Initial guess from the previous solutions. Not needed by the direct solver.
+   if (pressureSolver != 3) {
+      initialPressureGuess(R2, Pdot);
+   }
+
+   double tol = pressureSolveTolerance(iter);
+   double relResidual;
+   int solverIter;
+   const char *solverName;
+
+   if (pressureSolver == 3) {
+      solverName = "Sparse Cholesky solve";
+      solvePressureCholesky(R2, Pdot, &relResidual);
+      solverIter = 0;
+   } else if (pressureSolver == 2) {
+      solverName = "Preconditioner iterations";
+      solverIter = solvePressureRichardson(R2, Pdot, tol, pressureMaxIter, &relResidual);
+   } else if (pressureSolver == 4) {
+      solverName = "Mixed precision PCG";
+      solverIter = solvePressureMixedPrecision(R2, Pdot, tol, pressureMaxIter, &relResidual);
+   } else if (pressureCGVariant == 1) {
+      solverName = "Pipelined PCG";
+      solverIter = solvePressurePipelinedCG(R2, Pdot, tol, pressureMaxIter, &relResidual);
+   } else if (pressureCGVariant == 2) {
+      solverName = "s-step CG";
+      solverIter = solvePressureSstepCG(R2, Pdot, tol, pressureMaxIter, &relResidual);
+   } else if (pressureRecycleVectors > 0) {
+      solverName = "Deflated PCG";
+      solverIter = solvePressureRecycledPCG(R2, Pdot, tol, pressureMaxIter, &relResidual);
+   } else {
+      solverName = "PCG";
+      solverIter = solvePressurePCG(R2, Pdot, tol, pressureMaxIter, &relResidual);
+   }
+
+   if (pressureSolver != 3) {
+      savePressureSolution(Pdot);
+   }
+
+   double wallClockTime = getHighResolutionTime(2, Start);
+
+   if (solverIter < 0) {
+      solverIter = -solverIter;
+      printf("WARNING: %s did not converge in %d iterations. Relative residual is %g.\n", solverName, solverIter, relResidual);
+   } else if (pressureSolver == 3) {
+      if (PRINT_TIMES) printf("%s. Relative residual is %g.\n", solverName, relResidual);
+   } else {
+      if (PRINT_TIMES) printf("%s converged after %d iterations. Relative residual is %g.\n", solverName, solverIter, relResidual);
+   }
+
+   nPressureSolves++;
+   nPressureIterations += solverIter;
+   pressureSolveTime += wallClockTime;
+
+}  // End of function nativePressureSolver()
+
+
+
+
+
 //========================================================================
 void applyBC_initial()
 //========================================================================
@@ -4117,8 +5110,10 @@ void applyBC_initial()
 void applyBC_Step1(int flag)
 //========================================================================
 {
-   // When flag=1, modify Md for velocity BCs. When flag=2, modify the right
-   // hand side vector of step 1 (R1) for velocity BCs.
+   // When flag=1, modify Md for velocity BCs. When flag=2, set MdInv to zero
+   // at velocity BC nodes. This acts as a 0/1 mask so that any vector
+   // multiplied by MdInv automatically satisfies the BCs, which lets steps 1
+   // and 3 skip the modification of their right hand side vectors.
 
    // WARNING : In step 1 velocity differences between 2 iterations is
    // calculated. Therefore when specifying velocity BCs a value of zero is
@@ -4137,11 +5132,9 @@ void applyBC_Step1(int flag)
    } else if (flag == 2) {
       for (int i = 0; i < BCnVelNodes; i++) {
          node = BCvelNodes[i][0];   // Node at which this velocity BC is specified.
-     
-         // Change R1 for the given u and v velocities.
-         R1[node]        = 0.0;  // This is not velocity, but velocity difference between 2 iterations.
-         R1[node + NN]   = 0.0;  // This is not velocity, but velocity difference between 2 iterations.
-         R1[node + 2*NN] = 0.0;  // This is not velocity, but velocity difference between 2 iterations.
+         MdInv[node]        = 0.0;
+         MdInv[node + NN]   = 0.0;
+         MdInv[node + 2*NN] = 0.0;
       }
    }
 }  // End of function applyBC_Step1()
@@ -4155,61 +5148,159 @@ void applyBC_Step2(int flag)
 //========================================================================
 {
    // When flag=1, modify Z for pressure BCs. When flag=2, modify the right
-   // hand side vector of step 2 (R2) for pressure BCs.
+   // hand side vector of step 2 (R2) for pressure BCs. When flag=3, set the
+   // level of the solution Pdot, which is needed only when the null space is
+   // handled by projection.
 
    // WARNING : In step 2 pressure differences between 2 iterations is
    // calculated. Therefore when specifying pressure BCs a value of zero is
    // specified instead of the original pressure value.
 
-   // In order not to break down the symmetry of [Z], we use the "LARGE number"
-   // trick.
+   // pressureNullSpace selects how the pressure level is fixed.
+   //   0: In order not to break down the symmetry of [Z], we use the "LARGE
+   //      number" trick. This makes [Z] badly conditioned.
+   //   1: [Z] is left singular. Mean of R2 is removed, so that the system is
+   //      consistent, and the iterative solvers remove the constant from
+   //      their search directions. Pdot is shifted after the solve.
+   //   2: Row and column of the pinned node are zeroed, except the
+   //      diagonal, i.e. that unknown is eliminated.
 
-   double LARGE = 1000;                                                                                                                               // TODO: Implement EBCs without the use of LARGE.
+   double LARGE = 1000;
 
    int node = zeroPressureNode;     // Node at which pressure is set to zero.
 
-   if (flag == 1) {
-      if (node > 0) {  // If node is negative it means we do not set pressure to zero at any node.
-         // Multiply Z[node][node] by LARGE
-		 for (int j = Z_cs->p[node]; j < Z_cs->p[node+1]; j++) {  // Go through column "node" of [Z].
-            if (Z_cs->i[j] == node) {   // Determine the position of the diagonal entry in column "node"
-               Z_cs->x[j] = Z_cs->x[j] * LARGE;
-               break;
+   // [Z] is available as its upper triangle in sorted CSR format with
+   // 0-based indices (see calculateZ()), or, when pressureMatrixFree is 1,
+   // only as its diagonal (see setupMatrixFreeZ()). In the latter case BCs
+   // are applied to the products with [Z] by multiplyZMatrixFree().
+
+   if (flag == 1 && pressureMatrixFree) {
+      if (pressureNullSpace == 1) {
+         // Row sums are the product of [Z] with a vector of ones
+         double *ones   = new double[NNp];
+         double *rowSum = new double[NNp];
+         vectorSet(NNp, 1.0, ones);
+         multiplyZMatrixFree(ones, rowSum);
+         double maxDiag = 0.0;
+         double maxRowSum = 0.0;
+         for (int r = 0; r < NNp; r++) {
+            maxDiag   = max(maxDiag, fabs(Z_diagonal[r]));
+            maxRowSum = max(maxRowSum, fabs(rowSum[r]));
+         }
+         delete[] ones;
+         delete[] rowSum;
+
+         pressureHasNullSpace = (maxRowSum <= 1e-10 * maxDiag);
+         if (pressureHasNullSpace) {
+            printf("Constant pressure is in the null space of [Z]. It is removed by projection.\n");
+         } else {
+            printf("[Z] is not singular. No pressure node needs to be fixed.\n");
+         }
+      } else if (node > 0) {
+         if (pressureNullSpace == 0) {
+            Z_pinShift = (LARGE - 1.0) * Z_diagonal[node];
+            Z_diagonal[node] = Z_diagonal[node] * LARGE;
+         } else if (pressureNullSpace == 2) {
+            // Column "node" is the product of [Z] with the unit vector of "node"
+            double *unit = new double[NNp];
+            Z_pinnedColumn = new double[NNp];
+            vectorSet(NNp, 0.0, unit);
+            unit[node] = 1.0;
+            multiplyZMatrixFree(unit, Z_pinnedColumn);
+            delete[] unit;
+         }
+      }
+   } else if (flag == 1) {
+      if (pressureNullSpace == 1) {
+         // Constant pressure is in the null space of [Z] only if no velocity
+         // is left free at the boundaries. Otherwise [Z] is not singular and
+         // nothing needs to be done.
+         double *rowSum = new double[NNp];
+         for (int r = 0; r < NNp; r++) {
+            rowSum[r] = 0.0;
+         }
+         double maxDiag = 0.0;
+         for (int r = 0; r < NNp; r++) {
+            for (int j = Z_rowStartsUpper[r]; j < Z_rowStartsUpper[r+1]; j++) {
+               int c = Z_colIndicesUpper[j];
+               rowSum[r] += Z_valuesUpper[j];
+               if (c == r) {
+                  maxDiag = max(maxDiag, fabs(Z_valuesUpper[j]));
+               } else {
+                  rowSum[c] += Z_valuesUpper[j];   // Symmetric entry in the lower triangle
+               }
+            }
+         }
+         double maxRowSum = 0.0;
+         for (int r = 0; r < NNp; r++) {
+            maxRowSum = max(maxRowSum, fabs(rowSum[r]));
+         }
+         delete[] rowSum;
+
+         pressureHasNullSpace = (maxRowSum <= 1e-10 * maxDiag);
+         if (pressureHasNullSpace) {
+            printf("Constant pressure is in the null space of [Z]. It is removed by projection.\n");
+         } else {
+            printf("[Z] is not singular. No pressure node needs to be fixed.\n");
+         }
+      } else if (node > 0) {  // If node is negative it means we do not set pressure to zero at any node.
+         // Diagonal is the first entry of row "node" of the upper triangle
+         for (int j = Z_rowStartsUpper[node]; j < Z_rowStartsUpper[node+1]; j++) {
+            if (Z_colIndicesUpper[j] == node) {
+               if (pressureNullSpace == 0) {
+                  Z_valuesUpper[j] = Z_valuesUpper[j] * LARGE;
+               }
+            } else if (pressureNullSpace == 2) {
+               Z_valuesUpper[j] = 0.0;
+            }
+         }
+         if (pressureNullSpace == 2) {   // Column "node" is in the rows above it
+            for (int r = 0; r < node; r++) {
+               int *first = Z_colIndicesUpper + Z_rowStartsUpper[r];
+               int *last  = Z_colIndicesUpper + Z_rowStartsUpper[r+1];
+               int *pos = lower_bound(first, last, node);
+               if (pos != last && *pos == node) {
+                  Z_valuesUpper[pos - Z_colIndicesUpper] = 0.0;
+               }
             }
          }
       }
    } else if (flag == 2) {
-      if (node > 0) {  // If node is negative it means we do not set pressure to zero at any node.
+      if (pressureNullSpace == 1) {
+         if (pressureHasNullSpace) {
+            double mean = 0.0;
+            for (int i = 0; i < NNp; i++) {
+               mean += R2[i];
+            }
+            mean = mean / NNp;
+            for (int i = 0; i < NNp; i++) {
+               R2[i] -= mean;
+            }
+         }
+      } else if (node > 0) {  // If node is negative it means we do not set pressure to zero at any node.
          R2[node] = 0.0;  // This is not the RHS for pressure, but pressure difference between 2 iterations.
       }
+   } else if (flag == 3) {
+      if (pressureNullSpace == 1 && pressureHasNullSpace) {
+         double shift = 0.0;
+         if (node > 0) {
+            shift = Pdot[node];
+         } else {
+            for (int i = 0; i < NNp; i++) {
+               shift += Pdot[i];
+            }
+            shift = shift / NNp;
+         }
+         for (int i = 0; i < NNp; i++) {
+            Pdot[i] -= shift;
+         }
+      }
    }
 }  // End of function applyBC_Step2()
 
 
 
 
-//========================================================================
-void applyBC_Step3()
-//========================================================================
-{
-   // Modify the right hand side vector of step 3 (R3) for velocity BCs.
-   
-   int node;
-
-   for (int i = 0; i < BCnVelNodes; i++) {
-      node = BCvelNodes[i][0];   // Node at which this velocity BC specified.
-  
-     // Change R3 for the given u and v velocities.
-     R3[node]        = 0.0;  // This is not velocity, but velocity difference between 2 iterations.
-     R3[node + NN]   = 0.0;  // This is not velocity, but velocity difference between 2 iterations.
-     R3[node + 2*NN] = 0.0;  // This is not velocity, but velocity difference between 2 iterations.
-   }
-}  // End of function applyBC_Step3()
-
-
-
-
-
 //========================================================================
 void readRestartFile()
 //========================================================================
@@ -4522,11 +5613,12 @@ double getHighResolutionTime(int flag, double start)
 
 
 //-----------------------------------------------------------------------------
-void waitForUser(string str)
+void waitForUser(const char *str)
 //-----------------------------------------------------------------------------
 {
    // Used for checking memory usage. Prints the input string to the screen and
-   // waits for the user to enter a character.
+   // waits for the user to enter a character. It is called in the time loop,
+   // so the message is not passed as a string object, which would allocate.
 
    char dummyUserInput;
    //cout << str;
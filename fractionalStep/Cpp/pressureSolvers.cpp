@@ -0,0 +1,5054 @@
+// Solvers and preconditioners for the pressure system [Z]{Pdot} = {R2} of
+// step 2 of the CPU version. [Z] is constant during the run, so everything
+// that depends only on [Z] is done once in setupPressureSolver(), which is
+// called at the end of step0(). Nothing is allocated during the solves.
+
+#include <stdio.h>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <omp.h>
+
+using namespace std;
+
+
+// Sparse and vector kernels of CPUcodes.cpp
+void vectorCopy(int, double *, double *);
+double vectorDot(int, double *, double *);
+double csrMultiplyDot(int, double *, int *, int *, double *, double *);
+double cgUpdate(int, double, double *, double *, double *, double *);
+
+
+// A preconditioner is defined by two functions. setup is called once after
+// [Z] is known and prepares everything that apply needs. apply calculates
+// z = C^-1 * r, where C is the preconditioning matrix.
+struct Preconditioner {
+   const char *name;
+   void (*setup)(int n, int *rowStarts, int *col, double *value);
+   void (*apply)(int n, double *r, double *z);
+};
+
+
+// [Z] in CSR format with 0-based indices. All rows are stored, not only the
+// upper triangle.
+static int     Zn;
+static int    *ZrowStarts;
+static int    *Zcol;
+static double *Zvalue;
+
+// In the matrix-free mode [Z] is not stored. Zoperator calculates y = [Z] * x
+// and Zdiagonal is the diagonal of [Z]. Both are set by setPressureOperator().
+static void   (*Zoperator)(double *x, double *y) = NULL;
+static double  *Zdiagonal = NULL;
+
+static Preconditioner *precond;     // Preconditioner selected in setupPressureSolver()
+
+static double *cgR, *cgZ, *cgP, *cgQ;   // Work vectors of the CG solver
+
+static double *jacobiDiagInv;       // Inverse of the diagonal of [Z]
+
+
+
+
+//========================================================================
+void noPreconditionerSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Nothing to prepare.
+
+}  // End of function noPreconditionerSetup()
+
+
+
+
+
+//========================================================================
+void noPreconditionerApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = r
+
+   vectorCopy(n, r, z);
+
+}  // End of function noPreconditionerApply()
+
+
+
+
+
+//========================================================================
+void jacobiSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Stores the inverse of the diagonal of [Z].
+
+   jacobiDiagInv = new double[n];
+
+   if (Zoperator != NULL) {   // Matrix-free mode, diagonal is given separately
+      for (int i = 0; i < n; i++) {
+         jacobiDiagInv[i] = 1.0 / Zdiagonal[i];
+      }
+      return;
+   }
+
+   for (int i = 0; i < n; i++) {
+      jacobiDiagInv[i] = 1.0;
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         if (col[j] == i) {
+            jacobiDiagInv[i] = 1.0 / value[j];
+            break;
+         }
+      }
+   }
+
+}  // End of function jacobiSetup()
+
+
+
+
+
+//========================================================================
+void jacobiApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = D^-1 * r, where D is the diagonal of [Z].
+
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      z[i] = jacobiDiagInv[i] * r[i];
+   }
+
+}  // End of function jacobiApply()
+
+
+
+
+
+//========================================================================
+void setPressureOperator(int n, void (*apply)(double *x, double *y), double *diagonal)
+//========================================================================
+{
+   // Selects the matrix-free mode, in which [Z] is never formed and the
+   // solvers use apply to calculate [Z] * x. diagonal is the diagonal of [Z],
+   // which is all that the Jacobi preconditioner needs. Must be called before
+   // setupPressureSolver(), which then receives NULL instead of the CSR
+   // arrays. Only the preconditioners that need nothing but the diagonal of
+   // [Z] are available in this mode.
+
+   Zn        = n;
+   Zoperator = apply;
+   Zdiagonal = diagonal;
+
+}  // End of function setPressureOperator()
+
+
+
+
+
+//========================================================================
+double zMultiplyDot(int n, double *x, double *y)
+//========================================================================
+{
+   // Calculates y = [Z] * x and returns the dot product of x and y, either
+   // with the stored [Z] or with the matrix-free operator.
+
+   if (Zoperator == NULL) {
+      return csrMultiplyDot(n, Zvalue, Zcol, ZrowStarts, x, y);
+   }
+
+   Zoperator(x, y);
+   return vectorDot(n, x, y);
+
+}  // End of function zMultiplyDot()
+
+
+
+
+
+//========================================================================
+// General sparse matrix tools used by the preconditioners
+//========================================================================
+
+// A general CSR matrix with 0-based indices.
+struct CSRmatrix {
+   int nRows, nCols;
+   int *rowStarts;
+   int *col;
+   double *value;
+};
+
+void csrSortRow(int *, double *, int);
+
+
+
+
+//========================================================================
+CSRmatrix csrAllocate(int nRows, int nCols, int nnz)
+//========================================================================
+{
+   CSRmatrix A;
+   A.nRows     = nRows;
+   A.nCols     = nCols;
+   A.rowStarts = new int[nRows+1];
+   A.col       = new int[nnz];
+   A.value     = new double[nnz];
+   return A;
+
+}  // End of function csrAllocate()
+
+
+
+
+
+//========================================================================
+void csrFree(CSRmatrix &A)
+//========================================================================
+{
+   delete[] A.rowStarts;
+   delete[] A.col;
+   delete[] A.value;
+
+}  // End of function csrFree()
+
+
+
+
+
+//========================================================================
+CSRmatrix csrTranspose(CSRmatrix &A)
+//========================================================================
+{
+   // Returns the transpose of A. Column indices of the result are sorted.
+
+   int nnz = A.rowStarts[A.nRows];
+   CSRmatrix T = csrAllocate(A.nCols, A.nRows, nnz);
+
+   for (int i = 0; i <= A.nCols; i++) {
+      T.rowStarts[i] = 0;
+   }
+   for (int j = 0; j < nnz; j++) {
+      T.rowStarts[A.col[j] + 1]++;
+   }
+   for (int i = 0; i < A.nCols; i++) {
+      T.rowStarts[i+1] += T.rowStarts[i];
+   }
+
+   int *position = new int[A.nCols];
+   for (int i = 0; i < A.nCols; i++) {
+      position[i] = T.rowStarts[i];
+   }
+
+   for (int r = 0; r < A.nRows; r++) {
+      for (int j = A.rowStarts[r]; j < A.rowStarts[r+1]; j++) {
+         int loc = position[A.col[j]]++;
+         T.col[loc]   = r;
+         T.value[loc] = A.value[j];
+      }
+   }
+
+   delete[] position;
+   return T;
+
+}  // End of function csrTranspose()
+
+
+
+
+
+//========================================================================
+CSRmatrix csrMatMat(CSRmatrix &A, CSRmatrix &B)
+//========================================================================
+{
+   // Returns A * B. Column indices of each row of the result are sorted.
+   // Gustavson's algorithm is used, first to count the nonzeros of each row
+   // and then to calculate them.
+
+   int *marker = new int[B.nCols];
+   for (int c = 0; c < B.nCols; c++) {
+      marker[c] = -1;
+   }
+
+   int *rowStarts = new int[A.nRows + 1];
+   rowStarts[0] = 0;
+   for (int i = 0; i < A.nRows; i++) {
+      int count = 0;
+      for (int ja = A.rowStarts[i]; ja < A.rowStarts[i+1]; ja++) {
+         int k = A.col[ja];
+         for (int jb = B.rowStarts[k]; jb < B.rowStarts[k+1]; jb++) {
+            int c = B.col[jb];
+            if (marker[c] != i) {
+               marker[c] = i;
+               count++;
+            }
+         }
+      }
+      rowStarts[i+1] = rowStarts[i] + count;
+   }
+
+   CSRmatrix C = csrAllocate(A.nRows, B.nCols, rowStarts[A.nRows]);
+   for (int i = 0; i <= A.nRows; i++) {
+      C.rowStarts[i] = rowStarts[i];
+   }
+   delete[] rowStarts;
+
+   // marker now stores the location of column c in the current row of C.
+   // Locations that belong to previous rows are smaller than the row start.
+   for (int c = 0; c < B.nCols; c++) {
+      marker[c] = -1;
+   }
+
+   for (int i = 0; i < A.nRows; i++) {
+      int start = C.rowStarts[i];
+      int pos = start;
+      for (int ja = A.rowStarts[i]; ja < A.rowStarts[i+1]; ja++) {
+         int k = A.col[ja];
+         double a = A.value[ja];
+         for (int jb = B.rowStarts[k]; jb < B.rowStarts[k+1]; jb++) {
+            int c = B.col[jb];
+            if (marker[c] < start) {
+               marker[c] = pos;
+               C.col[pos] = c;
+               C.value[pos] = a * B.value[jb];
+               pos++;
+            } else {
+               C.value[marker[c]] += a * B.value[jb];
+            }
+         }
+      }
+      csrSortRow(C.col + start, C.value + start, pos - start);
+   }
+
+   delete[] marker;
+   return C;
+
+}  // End of function csrMatMat()
+
+
+
+
+
+//========================================================================
+void csrSortRow(int *col, double *value, int n)
+//========================================================================
+{
+   // Sorts the nonzeros of a single row in ascending column order. Rows are
+   // short, so insertion sort is used.
+
+   for (int i = 1; i < n; i++) {
+      int c = col[i];
+      double v = value[i];
+      int j = i - 1;
+      while (j >= 0 && col[j] > c) {
+         col[j+1]   = col[j];
+         value[j+1] = value[j];
+         j--;
+      }
+      col[j+1]   = c;
+      value[j+1] = v;
+   }
+
+}  // End of function csrSortRow()
+
+
+
+
+
+//========================================================================
+void csrMultiply(CSRmatrix &A, double *x, double *y)
+//========================================================================
+{
+   // y = A * x
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < A.nRows; i++) {
+      double sum = 0.0;
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         sum += A.value[j] * x[A.col[j]];
+      }
+      y[i] = sum;
+   }
+
+}  // End of function csrMultiply()
+
+
+
+
+
+//========================================================================
+void csrResidual(CSRmatrix &A, double *b, double *x, double *r)
+//========================================================================
+{
+   // r = b - A * x
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < A.nRows; i++) {
+      double sum = b[i];
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         sum -= A.value[j] * x[A.col[j]];
+      }
+      r[i] = sum;
+   }
+
+}  // End of function csrResidual()
+
+
+
+
+
+//========================================================================
+void csrInverseDiagonal(CSRmatrix &A, double *Dinv)
+//========================================================================
+{
+   // Dinv = inverse of the diagonal of A. A zero diagonal gives zero.
+
+   for (int i = 0; i < A.nRows; i++) {
+      Dinv[i] = 0.0;
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         if (A.col[j] == i) {
+            if (A.value[j] != 0.0) {
+               Dinv[i] = 1.0 / A.value[j];
+            }
+            break;
+         }
+      }
+   }
+
+}  // End of function csrInverseDiagonal()
+
+
+
+
+
+//========================================================================
+double estimateLambdaMax(CSRmatrix &A, double *Dinv, double *v, double *w)
+//========================================================================
+{
+   // Estimates the largest eigenvalue of D^-1 A with a few power iterations.
+   // D^-1 A is self-adjoint in the D inner product, which is used for the
+   // norms. The estimate is increased by 10% to make it an upper bound, as
+   // the power method approaches the eigenvalue from below. v and w are
+   // work vectors.
+
+   int n = A.nRows;
+   double lambda = 0.0;
+
+   for (int i = 0; i < n; i++) {   // A start vector that is not smooth
+      v[i] = 1.0 + 0.5 * sin(12.9898 * i);
+   }
+
+   for (int k = 0; k < 20; k++) {
+      csrMultiply(A, v, w);
+
+      double vNorm = 0.0, wNorm = 0.0;
+      for (int i = 0; i < n; i++) {
+         if (Dinv[i] != 0.0) {
+            w[i] *= Dinv[i];
+            vNorm += v[i] * v[i] / Dinv[i];
+            wNorm += w[i] * w[i] / Dinv[i];
+         } else {
+            w[i] = 0.0;
+         }
+      }
+
+      if (wNorm == 0.0) {
+         break;
+      }
+      lambda = sqrt(wNorm / vNorm);
+
+      double scale = 1.0 / sqrt(wNorm);
+      for (int i = 0; i < n; i++) {
+         v[i] = w[i] * scale;
+      }
+   }
+
+   return 1.1 * lambda;
+
+}  // End of function estimateLambdaMax()
+
+
+
+
+
+//========================================================================
+void chebyshevSmooth(CSRmatrix &A, double *Dinv, double lambdaMin, double lambdaMax, int degree,
+                     double *b, double *x, bool zeroGuess, double *r, double *d)
+//========================================================================
+{
+   // Improves the solution x of A x = b by a Chebyshev polynomial of D^-1 A
+   // of the given degree, which damps the error components with eigenvalues
+   // in [lambdaMin, lambdaMax]. If zeroGuess is 1 the incoming x is not used
+   // and taken to be zero. r and d are work vectors.
+   // Reference: Saad, Iterative Methods for Sparse Linear Systems, Alg. 12.1
+
+   int n = A.nRows;
+   double theta = 0.5 * (lambdaMax + lambdaMin);
+   double delta = 0.5 * (lambdaMax - lambdaMin);
+   double sigma = theta / delta;
+   double rho = 1.0 / sigma;
+
+   if (zeroGuess) {
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+         d[i] = Dinv[i] * b[i] / theta;
+      }
+   } else {
+      csrResidual(A, b, x, r);
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         d[i] = Dinv[i] * r[i] / theta;
+      }
+   }
+
+   for (int k = 0; k < degree; k++) {
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         x[i] += d[i];
+      }
+
+      if (k == degree - 1) {
+         break;
+      }
+
+      csrResidual(A, b, x, r);
+      double rhoNew = 1.0 / (2.0 * sigma - rho);
+      double c1 = rhoNew * rho;
+      double c2 = 2.0 * rhoNew / delta;
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         d[i] = c1 * d[i] + c2 * Dinv[i] * r[i];
+      }
+      rho = rhoNew;
+   }
+
+}  // End of function chebyshevSmooth()
+
+
+
+
+
+//========================================================================
+void denseCholesky(CSRmatrix &A, double *L)
+//========================================================================
+{
+   // Calculates the lower triangular Cholesky factor L of the small matrix A
+   // in dense form (n x n, row by row). A pivot that is not positive
+   // indicates a singular direction, e.g. the constant pressure when no
+   // pressure node is fixed. It is stored as zero and that component of the
+   // solution is set to zero by denseCholeskySolve().
+
+   int n = A.nRows;
+
+   for (long i = 0; i < (long)n * n; i++) {
+      L[i] = 0.0;
+   }
+   double maxDiag = 0.0;
+   for (int i = 0; i < n; i++) {
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         L[i*n + A.col[j]] = A.value[j];
+         if (A.col[j] == i && fabs(A.value[j]) > maxDiag) {
+            maxDiag = fabs(A.value[j]);
+         }
+      }
+   }
+
+   for (int k = 0; k < n; k++) {
+      double pivot = L[k*n + k];
+      for (int m = 0; m < k; m++) {
+         pivot -= L[k*n + m] * L[k*n + m];
+      }
+
+      if (pivot <= 1e-12 * maxDiag) {
+         for (int i = k; i < n; i++) {
+            L[i*n + k] = 0.0;
+         }
+         continue;
+      }
+
+      double Lkk = sqrt(pivot);
+      L[k*n + k] = Lkk;
+
+      for (int i = k+1; i < n; i++) {
+         double sum = L[i*n + k];
+         for (int m = 0; m < k; m++) {
+            sum -= L[i*n + m] * L[k*n + m];
+         }
+         L[i*n + k] = sum / Lkk;
+      }
+   }
+
+   // Clear the upper triangle that still has the values of A.
+   for (int i = 0; i < n; i++) {
+      for (int j = i+1; j < n; j++) {
+         L[i*n + j] = 0.0;
+      }
+   }
+
+}  // End of function denseCholesky()
+
+
+
+
+
+//========================================================================
+void denseCholeskySolve(int n, double *L, double *b, double *x)
+//========================================================================
+{
+   // Solves L L^T x = b using the factor calculated by denseCholesky().
+
+   for (int i = 0; i < n; i++) {      // Forward substitution, L y = b
+      if (L[i*n + i] == 0.0) {
+         x[i] = 0.0;
+         continue;
+      }
+      double sum = b[i];
+      for (int j = 0; j < i; j++) {
+         sum -= L[i*n + j] * x[j];
+      }
+      x[i] = sum / L[i*n + i];
+   }
+
+   for (int i = n-1; i >= 0; i--) {   // Backward substitution, L^T x = y
+      if (L[i*n + i] == 0.0) {
+         x[i] = 0.0;
+         continue;
+      }
+      double sum = x[i];
+      for (int j = i+1; j < n; j++) {
+         sum -= L[j*n + i] * x[j];
+      }
+      x[i] = sum / L[i*n + i];
+   }
+
+}  // End of function denseCholeskySolve()
+
+
+
+
+
+//========================================================================
+// Multigrid V-cycle
+//========================================================================
+// Multigrid preconditioners (AMG and GMG below) differ only in how they
+// build the levels. Both fill mgLevels and use the same V-cycle. Chebyshev
+// polynomials of D^-1 A are used as smoother, because they are symmetric,
+// which CG needs, and parallel, unlike Gauss-Seidel. The coarsest level is
+// solved by a dense Cholesky factorization.
+
+static const int    MG_MAX_LEVELS = 10;            // Max. number of levels, including the finest one
+static const int    MG_COARSEST_SIZE = 300;        // Coarsening stops when a level is this small
+static const int    MG_SMOOTHER_DEGREE = 2;        // Degree of the Chebyshev smoother
+static const double MG_SMOOTHER_RANGE = 0.3;       // Chebyshev smoother damps the eigenvalues in [RANGE * lambdaMax, lambdaMax]
+
+struct MGlevel {
+   CSRmatrix A;              // Matrix of this level
+   CSRmatrix P;              // Prolongation from the next coarser level to this one
+   CSRmatrix R;              // Restriction from this level to the next coarser one, transpose of P
+   double *Dinv;             // Inverse of the diagonal of A
+   double lambdaMax;         // Upper bound of the eigenvalues of D^-1 A
+   double *x, *b;            // Solution and RHS of this level during a V-cycle
+   double *r, *d;            // Work vectors of the smoother and the residual calculation
+};
+
+static MGlevel mgLevels[MG_MAX_LEVELS];
+static int     mgNlevels;
+static double *mgCoarseFactor;   // Dense Cholesky factor of the coarsest level matrix, stored row by row
+
+
+
+
+//========================================================================
+void mgInitializeLevel(MGlevel &L)
+//========================================================================
+{
+   // Calculates the inverse of the diagonal and the largest eigenvalue
+   // estimate of a level, and allocates its work vectors.
+
+   int n = L.A.nRows;
+
+   L.Dinv = new double[n];
+   L.x    = new double[n];
+   L.b    = new double[n];
+   L.r    = new double[n];
+   L.d    = new double[n];
+
+   csrInverseDiagonal(L.A, L.Dinv);
+   L.lambdaMax = estimateLambdaMax(L.A, L.Dinv, L.r, L.d);
+
+}  // End of function mgInitializeLevel()
+
+
+
+
+
+//========================================================================
+void mgSetFinestLevel(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // [Z] itself is used at the finest level, i.e. it is not copied.
+
+   MGlevel &L0 = mgLevels[0];
+   L0.A.nRows     = n;
+   L0.A.nCols     = n;
+   L0.A.rowStarts = rowStarts;
+   L0.A.col       = col;
+   L0.A.value     = value;
+   mgInitializeLevel(L0);
+
+   mgNlevels = 1;
+
+}  // End of function mgSetFinestLevel()
+
+
+
+
+
+//========================================================================
+void mgAddCoarseLevel(CSRmatrix &P)
+//========================================================================
+{
+   // Adds a new coarsest level using the given prolongation from it to the
+   // current coarsest level. Its matrix is the Galerkin product P^T A P.
+
+   MGlevel &fine = mgLevels[mgNlevels-1];
+   fine.P = P;
+   fine.R = csrTranspose(P);
+
+   CSRmatrix AP = csrMatMat(fine.A, fine.P);
+   MGlevel &coarse = mgLevels[mgNlevels];
+   coarse.A = csrMatMat(fine.R, AP);
+   csrFree(AP);
+
+   mgInitializeLevel(coarse);
+   mgNlevels++;
+
+}  // End of function mgAddCoarseLevel()
+
+
+
+
+
+//========================================================================
+void mgFinishSetup(const char *name)
+//========================================================================
+{
+   // Factorizes the coarsest level matrix and prints the hierarchy.
+
+   CSRmatrix &Ac = mgLevels[mgNlevels-1].A;
+   mgCoarseFactor = new double[(long)Ac.nRows * Ac.nRows];
+   denseCholesky(Ac, mgCoarseFactor);
+
+   printf("%s levels (rows / nonzeros):", name);
+   for (int l = 0; l < mgNlevels; l++) {
+      printf("  %d / %d", mgLevels[l].A.nRows, mgLevels[l].A.rowStarts[mgLevels[l].A.nRows]);
+   }
+   printf("\n");
+
+}  // End of function mgFinishSetup()
+
+
+
+
+
+//========================================================================
+void mgVcycle(int level, double *b, double *x)
+//========================================================================
+{
+   // Approximately solves A x = b at the given level with a V-cycle. The
+   // incoming value of x is not used.
+
+   MGlevel &L = mgLevels[level];
+
+   if (level == mgNlevels - 1) {
+      denseCholeskySolve(L.A.nRows, mgCoarseFactor, b, x);
+      return;
+   }
+
+   MGlevel &C = mgLevels[level + 1];
+
+   chebyshevSmooth(L.A, L.Dinv, MG_SMOOTHER_RANGE * L.lambdaMax, L.lambdaMax, MG_SMOOTHER_DEGREE, b, x, 1, L.r, L.d);
+
+   csrResidual(L.A, b, x, L.r);
+   csrMultiply(L.R, L.r, C.b);
+
+   mgVcycle(level + 1, C.b, C.x);
+
+   // x = x + P * xCoarse
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < L.P.nRows; i++) {
+      double sum = 0.0;
+      for (int j = L.P.rowStarts[i]; j < L.P.rowStarts[i+1]; j++) {
+         sum += L.P.value[j] * C.x[L.P.col[j]];
+      }
+      x[i] += sum;
+   }
+
+   chebyshevSmooth(L.A, L.Dinv, MG_SMOOTHER_RANGE * L.lambdaMax, L.lambdaMax, MG_SMOOTHER_DEGREE, b, x, 0, L.r, L.d);
+
+}  // End of function mgVcycle()
+
+
+
+
+
+//========================================================================
+void mgApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = (one V-cycle) * r
+
+   mgVcycle(0, r, z);
+
+}  // End of function mgApply()
+
+
+
+
+
+//========================================================================
+// Smoothed aggregation algebraic multigrid (AMG)
+//========================================================================
+// Levels are built as follows
+//   1. Nodes of the current level are grouped into aggregates using the
+//      strong connections of the matrix.
+//   2. Tentative prolongation P0 is piecewise constant on the aggregates,
+//      which represents the constant near null space of the pressure
+//      equation.
+//   3. It is smoothed by a damped Jacobi step, P = (I - w D^-1 A) P0.
+//   4. Coarse level matrix is the Galerkin product P^T A P.
+
+static const double AMG_STRENGTH_THRESHOLD = 0.25;  // |a_ij| >= threshold * max_k|a_ik| (k != i) is a strong connection
+
+
+
+
+//========================================================================
+int amgAggregate(CSRmatrix &A, int *aggregate)
+//========================================================================
+{
+   // Groups the nodes of A into aggregates and returns the number of
+   // aggregates. aggregate[i] is the aggregate of node i. Standard three
+   // phase greedy algorithm is used.
+   //   1. A node whose strong neighbors are all free forms a new aggregate
+   //      with them.
+   //   2. Remaining nodes join the aggregate of one of their strong
+   //      neighbors.
+   //   3. Still remaining nodes form new aggregates with their free strong
+   //      neighbors.
+
+   // Strength of connection is measured relative to the largest off-diagonal
+   // entry of the row, not to the diagonal. [Z] has a wide stencil whose
+   // off-diagonal entries are all small compared to the diagonal, and some
+   // of them are positive, so the usual sqrt(a_ii * a_jj) scaling marks
+   // almost all connections as weak.
+
+   int n = A.nRows;
+   int nAggregates = 0;
+
+   double *cutoff = new double[n];   // Entries of row i smaller than cutoff[i] in magnitude are weak.
+   for (int i = 0; i < n; i++) {
+      double maxOffDiag = 0.0;
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         if (A.col[j] != i && fabs(A.value[j]) > maxOffDiag) {
+            maxOffDiag = fabs(A.value[j]);
+         }
+      }
+      cutoff[i] = AMG_STRENGTH_THRESHOLD * maxOffDiag;
+      aggregate[i] = -1;
+   }
+
+   // Phase 1
+   for (int i = 0; i < n; i++) {
+      if (aggregate[i] != -1) {
+         continue;
+      }
+      bool neighborsFree = 1;
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         int c = A.col[j];
+         if (c != i && fabs(A.value[j]) >= cutoff[i] && aggregate[c] != -1) {
+            neighborsFree = 0;
+            break;
+         }
+      }
+      if (!neighborsFree) {
+         continue;
+      }
+      aggregate[i] = nAggregates;
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         int c = A.col[j];
+         if (fabs(A.value[j]) >= cutoff[i]) {
+            aggregate[c] = nAggregates;
+         }
+      }
+      nAggregates++;
+   }
+
+   // Phase 2. New aggregate numbers are marked as negative numbers so that
+   // nodes joining an aggregate in this phase are not used as seeds.
+   for (int i = 0; i < n; i++) {
+      if (aggregate[i] != -1) {
+         continue;
+      }
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         int c = A.col[j];
+         if (c != i && fabs(A.value[j]) >= cutoff[i] && aggregate[c] >= 0) {
+            aggregate[i] = -2 - aggregate[c];
+            break;
+         }
+      }
+   }
+   for (int i = 0; i < n; i++) {
+      if (aggregate[i] <= -2) {
+         aggregate[i] = -2 - aggregate[i];
+      }
+   }
+
+   // Phase 3
+   for (int i = 0; i < n; i++) {
+      if (aggregate[i] != -1) {
+         continue;
+      }
+      aggregate[i] = nAggregates;
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1]; j++) {
+         int c = A.col[j];
+         if (aggregate[c] == -1 && fabs(A.value[j]) >= cutoff[i]) {
+            aggregate[c] = nAggregates;
+         }
+      }
+      nAggregates++;
+   }
+
+   delete[] cutoff;
+
+   return nAggregates;
+
+}  // End of function amgAggregate()
+
+
+
+
+
+//========================================================================
+CSRmatrix amgProlongation(CSRmatrix &A, double *Dinv, double lambdaMax, int *aggregate, int nAggregates)
+//========================================================================
+{
+   // Calculates the smoothed prolongation P = (I - w D^-1 A) P0, where P0 is
+   // the tentative prolongation with a single nonzero at each row. Columns of
+   // P0 are normalized. w = 4 / (3 * lambdaMax) is the usual choice.
+
+   int n = A.nRows;
+   double omega = 4.0 / (3.0 * lambdaMax);
+
+   int *aggregateSize = new int[nAggregates];
+   for (int a = 0; a < nAggregates; a++) {
+      aggregateSize[a] = 0;
+   }
+   for (int i = 0; i < n; i++) {
+      aggregateSize[aggregate[i]]++;
+   }
+
+   CSRmatrix P0 = csrAllocate(n, nAggregates, n);
+   for (int i = 0; i <= n; i++) {
+      P0.rowStarts[i] = i;
+   }
+   for (int i = 0; i < n; i++) {
+      P0.col[i] = aggregate[i];
+      P0.value[i] = 1.0 / sqrt((double)aggregateSize[aggregate[i]]);
+   }
+
+   // Since the diagonal of A is nonzero, the sparsity pattern of A * P0
+   // includes that of P0.
+   CSRmatrix P = csrMatMat(A, P0);
+
+   for (int i = 0; i < n; i++) {
+      for (int j = P.rowStarts[i]; j < P.rowStarts[i+1]; j++) {
+         P.value[j] = -omega * Dinv[i] * P.value[j];
+         if (P.col[j] == aggregate[i]) {
+            P.value[j] += P0.value[i];
+         }
+      }
+   }
+
+   csrFree(P0);
+   delete[] aggregateSize;
+
+   return P;
+
+}  // End of function amgProlongation()
+
+
+
+
+
+//========================================================================
+void amgSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Builds the AMG hierarchy.
+
+   mgSetFinestLevel(n, rowStarts, col, value);
+
+   while (mgNlevels < MG_MAX_LEVELS && mgLevels[mgNlevels-1].A.nRows > MG_COARSEST_SIZE) {
+      MGlevel &fine = mgLevels[mgNlevels-1];
+      int nFine = fine.A.nRows;
+
+      int *aggregate = new int[nFine];
+      int nCoarse = amgAggregate(fine.A, aggregate);
+
+      if (nCoarse > 0.8 * nFine) {   // Coarsening stagnates, e.g. no strong connections are left
+         delete[] aggregate;
+         break;
+      }
+
+      CSRmatrix P = amgProlongation(fine.A, fine.Dinv, fine.lambdaMax, aggregate, nCoarse);
+      delete[] aggregate;
+
+      mgAddCoarseLevel(P);
+   }
+
+   mgFinishSetup("AMG");
+
+}  // End of function amgSetup()
+
+
+
+
+
+//========================================================================
+// Geometric multigrid (GMG)
+//========================================================================
+// For logically Cartesian meshes, such as the ones created by the structured
+// mesh generators, pressure nodes form a tensor product grid. Levels are
+// built by removing every other grid line in each direction (2:1
+// coarsening). Prolongation is trilinear interpolation, calculated from the
+// actual node coordinates so that stretched grids are handled properly.
+// Coarse level matrices are the Galerkin products P^T A P of [Z]. Compared
+// to AMG no aggregation or prolongation smoothing is necessary, which makes
+// the setup cheaper and the coarse matrices sparser. If the pressure nodes
+// do not form a tensor product grid AMG is used instead.
+
+static double **pressureCoord;   // Coordinates of the pressure nodes. Set in setupPressureSolver().
+
+struct CoordinateLess {   // Compares two pressure nodes by one of their coordinates
+   int dir;
+   bool operator()(int a, int b) const { return pressureCoord[a][dir] < pressureCoord[b][dir]; }
+};
+
+struct GMGgrid {
+   int nPoints[3];       // Number of grid lines in x, y and z directions
+   double *lines[3];     // Coordinates of the grid lines in each direction
+};
+
+
+
+
+//========================================================================
+int gmgFindGridLines(int n, int dir, double tol, double *lines)
+//========================================================================
+{
+   // Finds the distinct values of coordinate dir of the pressure nodes, in
+   // ascending order. Values closer than tol are taken to be the same.
+   // Returns their number.
+
+   double *values = new double[n];
+   for (int i = 0; i < n; i++) {
+      values[i] = pressureCoord[i][dir];
+   }
+   sort(values, values + n);
+
+   int nLines = 0;
+   for (int i = 0; i < n; i++) {
+      if (nLines == 0 || values[i] - lines[nLines-1] > tol) {
+         lines[nLines++] = values[i];
+      }
+   }
+
+   delete[] values;
+   return nLines;
+
+}  // End of function gmgFindGridLines()
+
+
+
+
+
+//========================================================================
+int gmgFindLine(double *lines, int nLines, double x, double tol)
+//========================================================================
+{
+   // Returns the index of the grid line at x, or -1 if there is none.
+
+   int index = lower_bound(lines, lines + nLines, x - tol) - lines;
+   if (index < nLines && fabs(lines[index] - x) <= tol) {
+      return index;
+   }
+   return -1;
+
+}  // End of function gmgFindLine()
+
+
+
+
+
+//========================================================================
+bool gmgFindFineGrid(int n, GMGgrid &grid, int *ijk)
+//========================================================================
+{
+   // Checks whether the pressure nodes form a tensor product grid. If they
+   // do, grid lines are returned in grid and the grid indices of node i in
+   // ijk[3*i], ijk[3*i+1] and ijk[3*i+2].
+
+   double minX[3], maxX[3];
+   for (int d = 0; d < 3; d++) {
+      minX[d] = maxX[d] = pressureCoord[0][d];
+   }
+   for (int i = 0; i < n; i++) {
+      for (int d = 0; d < 3; d++) {
+         minX[d] = min(minX[d], pressureCoord[i][d]);
+         maxX[d] = max(maxX[d], pressureCoord[i][d]);
+      }
+   }
+   double size = max(maxX[0] - minX[0], max(maxX[1] - minX[1], maxX[2] - minX[2]));
+   double tol = 1e-8 * size;
+
+   for (int d = 0; d < 3; d++) {
+      grid.lines[d] = new double[n];
+      grid.nPoints[d] = gmgFindGridLines(n, d, tol, grid.lines[d]);
+   }
+
+   if ((long)grid.nPoints[0] * grid.nPoints[1] * grid.nPoints[2] != n) {
+      return 0;
+   }
+
+   // Each grid point should have exactly one node.
+   bool *isUsed = new bool[n];
+   for (int i = 0; i < n; i++) {
+      isUsed[i] = 0;
+   }
+
+   bool isTensorGrid = 1;
+   for (int i = 0; i < n && isTensorGrid; i++) {
+      for (int d = 0; d < 3; d++) {
+         ijk[3*i + d] = gmgFindLine(grid.lines[d], grid.nPoints[d], pressureCoord[i][d], tol);
+      }
+      int gridIndex = ijk[3*i] + grid.nPoints[0] * (ijk[3*i+1] + grid.nPoints[1] * ijk[3*i+2]);
+      if (isUsed[gridIndex]) {
+         isTensorGrid = 0;
+      }
+      isUsed[gridIndex] = 1;
+   }
+
+   delete[] isUsed;
+   return isTensorGrid;
+
+}  // End of function gmgFindFineGrid()
+
+
+
+
+
+//========================================================================
+int gmgCoarsenLines(int nFine, double *fineLines, double *coarseLines, int *fineToCoarse)
+//========================================================================
+{
+   // 2:1 coarsening of the grid lines of a single direction. Even numbered
+   // lines are kept. The last line is always kept, even if it is odd
+   // numbered. fineToCoarse gives the coarse number of a kept line and -1
+   // for removed lines. Returns the number of coarse lines.
+
+   int nCoarse = 0;
+   for (int i = 0; i < nFine; i++) {
+      if (i % 2 == 0 || i == nFine - 1) {
+         coarseLines[nCoarse] = fineLines[i];
+         fineToCoarse[i] = nCoarse++;
+      } else {
+         fineToCoarse[i] = -1;
+      }
+   }
+   return nCoarse;
+
+}  // End of function gmgCoarsenLines()
+
+
+
+
+
+//========================================================================
+CSRmatrix gmgProlongation(int nFine, int *ijk, GMGgrid &fine, GMGgrid &coarse)
+//========================================================================
+{
+   // Trilinear interpolation from the coarse grid to the fine grid. Row i of
+   // the result is for the fine node with grid indices ijk[3*i], ijk[3*i+1]
+   // and ijk[3*i+2]. Columns are numbered lexicographically on the coarse
+   // grid. ijk is not used and can be NULL if rows are lexicographic too.
+
+   // 1D interpolation in each direction. A fine line either coincides with a
+   // coarse line, or lies between coarse lines number left and left+1.
+   int *left[3];
+   double *weight[3];   // Weight of the left coarse line
+   int *fineToCoarse = new int[max(fine.nPoints[0], max(fine.nPoints[1], fine.nPoints[2]))];
+
+   for (int d = 0; d < 3; d++) {
+      int m = fine.nPoints[d];
+      left[d]   = new int[m];
+      weight[d] = new double[m];
+
+      double *dummyLines = new double[m];
+      gmgCoarsenLines(m, fine.lines[d], dummyLines, fineToCoarse);
+      delete[] dummyLines;
+
+      for (int i = 0; i < m; i++) {
+         if (fineToCoarse[i] >= 0) {
+            left[d][i] = fineToCoarse[i];
+            weight[d][i] = 1.0;
+         } else {   // Odd numbered line, neighbors i-1 and i+1 are coarse lines
+            left[d][i] = fineToCoarse[i-1];
+            double xl = fine.lines[d][i-1];
+            double xr = fine.lines[d][i+1];
+            weight[d][i] = (xr - fine.lines[d][i]) / (xr - xl);
+         }
+      }
+   }
+   delete[] fineToCoarse;
+
+   CSRmatrix P = csrAllocate(nFine, coarse.nPoints[0] * coarse.nPoints[1] * coarse.nPoints[2], 8 * nFine);
+
+   int nnz = 0;
+   P.rowStarts[0] = 0;
+   for (int r = 0; r < nFine; r++) {
+      int g[3];
+      if (ijk != NULL) {
+         g[0] = ijk[3*r];   g[1] = ijk[3*r+1];   g[2] = ijk[3*r+2];
+      } else {
+         g[0] = r % fine.nPoints[0];
+         g[1] = (r / fine.nPoints[0]) % fine.nPoints[1];
+         g[2] = r / (fine.nPoints[0] * fine.nPoints[1]);
+      }
+
+      // Up to 2 coarse lines in each direction
+      int nc[3], c[3][2];
+      double w[3][2];
+      for (int d = 0; d < 3; d++) {
+         c[d][0] = left[d][g[d]];
+         w[d][0] = weight[d][g[d]];
+         nc[d] = 1;
+         if (w[d][0] < 1.0) {
+            c[d][1] = c[d][0] + 1;
+            w[d][1] = 1.0 - w[d][0];
+            nc[d] = 2;
+         }
+      }
+
+      int start = nnz;
+      for (int a = 0; a < nc[2]; a++) {
+         for (int b = 0; b < nc[1]; b++) {
+            for (int e = 0; e < nc[0]; e++) {
+               P.col[nnz] = c[0][e] + coarse.nPoints[0] * (c[1][b] + coarse.nPoints[1] * c[2][a]);
+               P.value[nnz] = w[0][e] * w[1][b] * w[2][a];
+               nnz++;
+            }
+         }
+      }
+      csrSortRow(P.col + start, P.value + start, nnz - start);
+      P.rowStarts[r+1] = nnz;
+   }
+
+   for (int d = 0; d < 3; d++) {
+      delete[] left[d];
+      delete[] weight[d];
+   }
+
+   return P;
+
+}  // End of function gmgProlongation()
+
+
+
+
+
+//========================================================================
+void gmgSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Builds the GMG hierarchy. Falls back to AMG if the pressure nodes do
+   // not form a tensor product grid.
+
+   GMGgrid fine, coarse;
+   int *ijk = new int[3*n];
+
+   if (!gmgFindFineGrid(n, fine, ijk)) {
+      printf("Pressure nodes do not form a structured grid. AMG will be used instead of GMG.\n");
+      for (int d = 0; d < 3; d++) {
+         delete[] fine.lines[d];
+      }
+      delete[] ijk;
+      amgSetup(n, rowStarts, col, value);
+      return;
+   }
+
+   mgSetFinestLevel(n, rowStarts, col, value);
+
+   int *dummyMap = new int[n];
+
+   while (mgNlevels < MG_MAX_LEVELS && mgLevels[mgNlevels-1].A.nRows > MG_COARSEST_SIZE) {
+      int nCoarse = 1;
+      for (int d = 0; d < 3; d++) {
+         coarse.lines[d] = new double[fine.nPoints[d]];
+         coarse.nPoints[d] = gmgCoarsenLines(fine.nPoints[d], fine.lines[d], coarse.lines[d], dummyMap);
+         nCoarse *= coarse.nPoints[d];
+      }
+
+      if (nCoarse == mgLevels[mgNlevels-1].A.nRows) {   // Grid can not be coarsened anymore
+         for (int d = 0; d < 3; d++) {
+            delete[] coarse.lines[d];
+         }
+         break;
+      }
+
+      // Rows of the finest level are the pressure nodes. Rows of the coarse
+      // levels are numbered lexicographically.
+      CSRmatrix P = gmgProlongation(mgLevels[mgNlevels-1].A.nRows, (mgNlevels == 1) ? ijk : NULL, fine, coarse);
+      mgAddCoarseLevel(P);
+
+      for (int d = 0; d < 3; d++) {
+         delete[] fine.lines[d];
+      }
+      fine = coarse;
+   }
+
+   for (int d = 0; d < 3; d++) {
+      delete[] fine.lines[d];
+   }
+   delete[] dummyMap;
+   delete[] ijk;
+
+   mgFinishSetup("GMG");
+
+}  // End of function gmgSetup()
+
+
+
+
+
+//========================================================================
+// Incomplete Cholesky preconditioner, IC(0)
+//========================================================================
+// [Z] is approximated by U^T U, where U is upper triangular with the same
+// sparsity pattern as the upper triangle of [Z]. Applying the
+// preconditioner needs a forward (U^T y = r) and a backward (U z = y)
+// triangular solve. These are parallelized by level scheduling. Rows of a
+// level depend only on rows of previous levels, so rows of a single level
+// are solved in parallel, with a barrier between levels. Natural ordering
+// of the rows is kept, since reordering them, e.g. by multicoloring,
+// increases the number of CG iterations.
+
+struct TriangularSolveLevels {
+   int nLevels;
+   int *levelStarts;   // Rows of level l are rows[levelStarts[l]] to rows[levelStarts[l+1]-1]
+   int *rows;
+};
+
+static CSRmatrix icU;        // Incomplete factor U. Diagonal is the first entry of each row.
+static CSRmatrix icL;        // U^T, used in the forward solve. Diagonal is the last entry of each row.
+static TriangularSolveLevels icForwardLevels, icBackwardLevels;
+static double *icY;          // Result of the forward solve
+
+
+
+
+//========================================================================
+void findSolveLevels(CSRmatrix &T, bool isLower, TriangularSolveLevels &levels)
+//========================================================================
+{
+   // Calculates the levels of the rows of the triangular matrix T for a
+   // level scheduled solve. Level of a row is one more than the largest level
+   // of the rows it depends on.
+
+   int n = T.nRows;
+   int *level = new int[n];
+   int maxLevel = -1;
+
+   for (int k = 0; k < n; k++) {
+      int i = isLower ? k : n-1-k;   // Rows are visited in the order of the sequential solve
+      int l = 0;
+      for (int j = T.rowStarts[i]; j < T.rowStarts[i+1]; j++) {
+         int c = T.col[j];
+         if (c != i && level[c] + 1 > l) {
+            l = level[c] + 1;
+         }
+      }
+      level[i] = l;
+      maxLevel = max(maxLevel, l);
+   }
+
+   levels.nLevels = maxLevel + 1;
+   levels.levelStarts = new int[levels.nLevels + 1];
+   levels.rows = new int[n];
+
+   for (int l = 0; l <= levels.nLevels; l++) {
+      levels.levelStarts[l] = 0;
+   }
+   for (int i = 0; i < n; i++) {
+      levels.levelStarts[level[i] + 1]++;
+   }
+   for (int l = 0; l < levels.nLevels; l++) {
+      levels.levelStarts[l+1] += levels.levelStarts[l];
+   }
+
+   int *position = new int[levels.nLevels];
+   for (int l = 0; l < levels.nLevels; l++) {
+      position[l] = levels.levelStarts[l];
+   }
+   for (int i = 0; i < n; i++) {
+      levels.rows[position[level[i]]++] = i;
+   }
+
+   delete[] position;
+   delete[] level;
+
+}  // End of function findSolveLevels()
+
+
+
+
+
+//========================================================================
+bool icFactorize(CSRmatrix &U, double shift)
+//========================================================================
+{
+   // Calculates the IC(0) factor in place. On entry U has the upper triangle
+   // of [Z] with sorted columns. Diagonal is multiplied by (1 + shift).
+   // Returns 0 if a non-positive pivot is found.
+
+   int n = U.nRows;
+   int *position = new int[n];   // Location of each column in the row being updated, or -1
+   for (int i = 0; i < n; i++) {
+      position[i] = -1;
+   }
+
+   bool success = 1;
+
+   if (shift != 0.0) {
+      for (int i = 0; i < n; i++) {
+         U.value[U.rowStarts[i]] *= (1.0 + shift);
+      }
+   }
+
+   for (int i = 0; i < n; i++) {
+      int diag = U.rowStarts[i];
+      if (U.value[diag] <= 0.0) {
+         success = 0;
+         break;
+      }
+      double Uii = sqrt(U.value[diag]);
+      U.value[diag] = Uii;
+      for (int j = diag + 1; j < U.rowStarts[i+1]; j++) {
+         U.value[j] /= Uii;
+      }
+
+      // Update the rows that row i couples to, keeping only the entries in
+      // the pattern of U.
+      for (int j = diag + 1; j < U.rowStarts[i+1]; j++) {
+         int r = U.col[j];
+         double Uir = U.value[j];
+
+         for (int k = U.rowStarts[r]; k < U.rowStarts[r+1]; k++) {
+            position[U.col[k]] = k;
+         }
+         for (int k = j; k < U.rowStarts[i+1]; k++) {
+            int loc = position[U.col[k]];
+            if (loc >= 0) {
+               U.value[loc] -= Uir * U.value[k];
+            }
+         }
+         for (int k = U.rowStarts[r]; k < U.rowStarts[r+1]; k++) {
+            position[U.col[k]] = -1;
+         }
+      }
+   }
+
+   delete[] position;
+   return success;
+
+}  // End of function icFactorize()
+
+
+
+
+
+//========================================================================
+void icSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Calculates the IC(0) factor of [Z] and the levels of the triangular
+   // solves. If the factorization breaks down, it is repeated with an
+   // increasing diagonal shift.
+
+   int nnzUpper = 0;
+   for (int i = 0; i < n; i++) {
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         if (col[j] >= i) {
+            nnzUpper++;
+         }
+      }
+   }
+
+   icU = csrAllocate(n, n, nnzUpper);
+
+   double shift = 0.0;
+   while (1) {
+      // Copy the upper triangle of [Z]. Columns of [Z] are sorted, so the
+      // diagonal is the first entry of each row.
+      int counter = 0;
+      icU.rowStarts[0] = 0;
+      for (int i = 0; i < n; i++) {
+         for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+            if (col[j] >= i) {
+               icU.col[counter]   = col[j];
+               icU.value[counter] = value[j];
+               counter++;
+            }
+         }
+         icU.rowStarts[i+1] = counter;
+      }
+
+      if (icFactorize(icU, shift)) {
+         break;
+      }
+      shift = (shift == 0.0) ? 1e-3 : 2.0 * shift;
+      printf("IC(0) factorization broke down. It is repeated with a diagonal shift of %g.\n", shift);
+   }
+
+   icL = csrTranspose(icU);
+
+   findSolveLevels(icL, 1, icForwardLevels);
+   findSolveLevels(icU, 0, icBackwardLevels);
+
+   icY = new double[n];
+
+   printf("IC(0) triangular solves have %d (forward) and %d (backward) levels for %d rows.\n",
+          icForwardLevels.nLevels, icBackwardLevels.nLevels, n);
+
+}  // End of function icSetup()
+
+
+
+
+
+//========================================================================
+void icApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = (U^T U)^-1 r, by a forward and a backward level scheduled solve.
+
+   #pragma omp parallel
+   {
+      // Forward solve, U^T y = r. Diagonal is the last entry of each row of L.
+      for (int l = 0; l < icForwardLevels.nLevels; l++) {
+         #pragma omp for schedule(static)
+         for (int k = icForwardLevels.levelStarts[l]; k < icForwardLevels.levelStarts[l+1]; k++) {
+            int i = icForwardLevels.rows[k];
+            int diag = icL.rowStarts[i+1] - 1;
+            double sum = r[i];
+            for (int j = icL.rowStarts[i]; j < diag; j++) {
+               sum -= icL.value[j] * icY[icL.col[j]];
+            }
+            icY[i] = sum / icL.value[diag];
+         }
+      }
+
+      // Backward solve, U z = y. Diagonal is the first entry of each row of U.
+      for (int l = 0; l < icBackwardLevels.nLevels; l++) {
+         #pragma omp for schedule(static)
+         for (int k = icBackwardLevels.levelStarts[l]; k < icBackwardLevels.levelStarts[l+1]; k++) {
+            int i = icBackwardLevels.rows[k];
+            int diag = icU.rowStarts[i];
+            double sum = icY[i];
+            for (int j = diag + 1; j < icU.rowStarts[i+1]; j++) {
+               sum -= icU.value[j] * z[icU.col[j]];
+            }
+            z[i] = sum / icU.value[diag];
+         }
+      }
+   }
+
+}  // End of function icApply()
+
+
+
+
+
+//========================================================================
+// Two-level deflation
+//========================================================================
+// Coarse space is spanned by the columns of W, which are constant on
+// subdomains of the pressure nodes and zero elsewhere. Subdomains are built
+// by recursive coordinate bisection. The coarse matrix E = W^T Z W is
+// factorized once by the dense Cholesky of the multigrid section. To keep
+// its memory and the cost of its solve in each application small, the
+// subdomain size grows with the number of nodes, so that E has at most
+// DEFLATION_MAX_SUBDOMAINS rows. The preconditioner is a smoothing step, a
+// coarse correction with E and another smoothing step, which is the
+// symmetric deflation preconditioner (A-DEF2) of deflated CG. It is
+// applied by the two-level V-cycle of the multigrid section, so the
+// smoother is its Chebyshev smoother. Deflation removes the low frequency
+// modes that slow down Jacobi-CG on stretched meshes. Its setup and memory
+// are much smaller than those of AMG.
+
+static const int DEFLATION_SUBDOMAIN_SIZE = 64;     // Max. number of pressure nodes in a subdomain on small meshes
+static const int DEFLATION_MAX_SUBDOMAINS = 1024;   // Max. number of subdomains, i.e. size of E. Dense factor of E takes 8 MB.
+
+
+
+
+//========================================================================
+void coordinateBisection(int *nodes, int count, int maxSize, int &nSubdomains, int *subdomain)
+//========================================================================
+{
+   // Splits nodes into subdomains of at most maxSize nodes
+   // by recursive bisection at the median coordinate in the direction of the
+   // largest extent.
+
+   double minX[3], maxX[3];
+   for (int d = 0; d < 3; d++) {
+      minX[d] = maxX[d] = pressureCoord[nodes[0]][d];
+   }
+   for (int k = 1; k < count; k++) {
+      for (int d = 0; d < 3; d++) {
+         minX[d] = min(minX[d], pressureCoord[nodes[k]][d]);
+         maxX[d] = max(maxX[d], pressureCoord[nodes[k]][d]);
+      }
+   }
+
+   CoordinateLess less;
+   less.dir = 0;
+   for (int d = 1; d < 3; d++) {
+      if (maxX[d] - minX[d] > maxX[less.dir] - minX[less.dir]) {
+         less.dir = d;
+      }
+   }
+
+   if (count <= maxSize || maxX[less.dir] == minX[less.dir]) {
+      for (int k = 0; k < count; k++) {
+         subdomain[nodes[k]] = nSubdomains;
+      }
+      nSubdomains++;
+      return;
+   }
+
+   int half = count / 2;
+   nth_element(nodes, nodes + half, nodes + count, less);
+
+   coordinateBisection(nodes, half, maxSize, nSubdomains, subdomain);
+   coordinateBisection(nodes + half, count - half, maxSize, nSubdomains, subdomain);
+
+}  // End of function coordinateBisection()
+
+
+
+
+
+//========================================================================
+void deflationSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Builds the subdomains, W and the factorized coarse matrix. If the node
+   // coordinates are not known, aggregates of AMG are used as subdomains.
+
+   int *subdomain = new int[n];
+   int nSubdomains = 0;
+
+   if (pressureCoord != NULL) {
+      // Bisection stops at parts of at most maxSize nodes, so it creates
+      // at most about 2 * n / maxSize subdomains.
+      int maxSize = max(DEFLATION_SUBDOMAIN_SIZE, (int)(2L * n / DEFLATION_MAX_SUBDOMAINS) + 1);
+      int *nodes = new int[n];
+      for (int i = 0; i < n; i++) {
+         nodes[i] = i;
+      }
+      coordinateBisection(nodes, n, maxSize, nSubdomains, subdomain);
+      delete[] nodes;
+   } else {
+      printf("Pressure node coordinates are not known. AMG aggregates are used as the subdomains of deflation.\n");
+      CSRmatrix Z;
+      Z.nRows     = n;
+      Z.nCols     = n;
+      Z.rowStarts = rowStarts;
+      Z.col       = col;
+      Z.value     = value;
+      nSubdomains = amgAggregate(Z, subdomain);
+
+      // Too many aggregates are merged in groups of consecutive ones, which
+      // are formed next to each other.
+      if (nSubdomains > DEFLATION_MAX_SUBDOMAINS) {
+         int groupSize = (nSubdomains + DEFLATION_MAX_SUBDOMAINS - 1) / DEFLATION_MAX_SUBDOMAINS;
+         for (int i = 0; i < n; i++) {
+            subdomain[i] /= groupSize;
+         }
+         nSubdomains = (nSubdomains + groupSize - 1) / groupSize;
+      }
+   }
+
+   CSRmatrix W = csrAllocate(n, nSubdomains, n);
+   for (int i = 0; i < n; i++) {
+      W.rowStarts[i] = i;
+      W.col[i]       = subdomain[i];
+      W.value[i]     = 1.0;
+   }
+   W.rowStarts[n] = n;
+   delete[] subdomain;
+
+   mgSetFinestLevel(n, rowStarts, col, value);
+   mgAddCoarseLevel(W);
+   mgFinishSetup("Deflation");
+
+}  // End of function deflationSetup()
+
+
+
+
+
+//========================================================================
+// Chebyshev polynomial preconditioner
+//========================================================================
+// C^-1 = p(D^-1 Z) D^-1, where p is the Chebyshev polynomial of the given
+// degree for the eigenvalue interval of D^-1 Z. Applying it needs only
+// multiplications with [Z] and vector updates, without dot products or
+// triangular solves, so a higher degree moves work from the CG iterations,
+// each of which has two reductions, to perfectly parallel operations.
+// Eigenvalue bounds are the extreme Ritz values of a few Lanczos steps.
+
+static const int CHEBYSHEV_LANCZOS_STEPS = 20;   // Number of Lanczos steps of the eigenvalue estimate
+
+static int       chebDegree = 4;                 // Degree of the polynomial, set by setChebyshevDegree()
+static CSRmatrix chebA;                          // [Z], not copied
+static double   *chebDinv;                       // Inverse of the diagonal of [Z]
+static double    chebLambdaMin, chebLambdaMax;   // Eigenvalue bounds of D^-1 Z
+static double   *chebR, *chebD;                  // Work vectors of chebyshevSmooth()
+
+
+
+
+//========================================================================
+void setChebyshevDegree(int degree)
+//========================================================================
+{
+   // Sets the degree of the Chebyshev preconditioner. Must be called before
+   // setupPressureSolver().
+
+   chebDegree = max(degree, 1);
+
+}  // End of function setChebyshevDegree()
+
+
+
+
+
+//========================================================================
+int tridiagonalEigenvalueCount(int m, double *a, double *b, double x)
+//========================================================================
+{
+   // Returns the number of eigenvalues smaller than x of the symmetric
+   // tridiagonal matrix with diagonal a and off-diagonal b (Sturm sequence).
+
+   int count = 0;
+   double q = a[0] - x;
+   for (int i = 0; i < m; i++) {
+      if (i > 0) {
+         q = a[i] - x - b[i-1] * b[i-1] / q;
+      }
+      if (q == 0.0) {
+         q = -1e-300;
+      }
+      if (q < 0.0) {
+         count++;
+      }
+   }
+   return count;
+
+}  // End of function tridiagonalEigenvalueCount()
+
+
+
+
+
+//========================================================================
+void lanczosEigenvalueBounds(CSRmatrix &A, double *Dinv, int nSteps, double *lambdaMin, double *lambdaMax)
+//========================================================================
+{
+   // Estimates the smallest and the largest eigenvalues of D^-1 A by the
+   // extreme eigenvalues of the tridiagonal matrix of nSteps Lanczos steps
+   // with the symmetric matrix D^-1/2 A D^-1/2, which has the same
+   // eigenvalues. Eigenvalues of the tridiagonal matrix are found by
+   // bisection.
+
+   int n = A.nRows;
+   double *v     = new double[n];
+   double *vPrev = new double[n];
+   double *w     = new double[n];
+   double *t     = new double[n];
+   double *alpha = new double[nSteps];
+   double *beta  = new double[nSteps];
+
+   double norm = 0.0;
+   for (int i = 0; i < n; i++) {   // A start vector that is not smooth
+      v[i] = 1.0 + 0.5 * sin(12.9898 * i);
+      vPrev[i] = 0.0;
+      norm += v[i] * v[i];
+   }
+   norm = sqrt(norm);
+   for (int i = 0; i < n; i++) {
+      v[i] /= norm;
+   }
+
+   int m = 0;
+   double betaPrev = 0.0;
+   for (int j = 0; j < nSteps; j++) {
+      // w = D^-1/2 A D^-1/2 v
+      for (int i = 0; i < n; i++) {
+         t[i] = sqrt(Dinv[i]) * v[i];
+      }
+      csrMultiply(A, t, w);
+      double a = 0.0;
+      for (int i = 0; i < n; i++) {
+         w[i] *= sqrt(Dinv[i]);
+         a += w[i] * v[i];
+      }
+
+      double b = 0.0;
+      for (int i = 0; i < n; i++) {
+         w[i] -= a * v[i] + betaPrev * vPrev[i];
+         b += w[i] * w[i];
+      }
+      b = sqrt(b);
+
+      alpha[m] = a;
+      beta[m]  = b;
+      m++;
+
+      if (b < 1e-12 * fabs(a)) {   // Invariant subspace is found
+         break;
+      }
+      for (int i = 0; i < n; i++) {
+         vPrev[i] = v[i];
+         v[i] = w[i] / b;
+      }
+      betaPrev = b;
+   }
+
+   // Gershgorin interval of the tridiagonal matrix, which is then bisected
+   double low = alpha[0], high = alpha[0];
+   for (int i = 0; i < m; i++) {
+      double radius = ((i > 0) ? fabs(beta[i-1]) : 0.0) + ((i < m-1) ? fabs(beta[i]) : 0.0);
+      low  = min(low,  alpha[i] - radius);
+      high = max(high, alpha[i] + radius);
+   }
+
+   for (int k = 0; k < 2; k++) {   // k = 0: smallest, k = 1: largest eigenvalue
+      int target = (k == 0) ? 1 : m;   // The eigenvalue is the smallest x with count(x) >= target
+      double x0 = low, x1 = high;
+      for (int iter = 0; iter < 100; iter++) {
+         double xm = 0.5 * (x0 + x1);
+         if (tridiagonalEigenvalueCount(m, alpha, beta, xm) >= target) {
+            x1 = xm;
+         } else {
+            x0 = xm;
+         }
+      }
+      if (k == 0) {
+         *lambdaMin = x1;
+      } else {
+         *lambdaMax = x1;
+      }
+   }
+
+   delete[] v;
+   delete[] vPrev;
+   delete[] w;
+   delete[] t;
+   delete[] alpha;
+   delete[] beta;
+
+}  // End of function lanczosEigenvalueBounds()
+
+
+
+
+
+//========================================================================
+void chebyshevSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Estimates the eigenvalue bounds of D^-1 Z. The largest Ritz value
+   // approaches the largest eigenvalue from below, so it is increased by 5%.
+   // The smallest Ritz value is larger than the smallest eigenvalue, which
+   // is safe, since the polynomial stays positive below the interval.
+
+   chebA.nRows     = n;
+   chebA.nCols     = n;
+   chebA.rowStarts = rowStarts;
+   chebA.col       = col;
+   chebA.value     = value;
+
+   chebDinv = new double[n];
+   chebR    = new double[n];
+   chebD    = new double[n];
+   csrInverseDiagonal(chebA, chebDinv);
+
+   double lambdaMin, lambdaMax;
+   lanczosEigenvalueBounds(chebA, chebDinv, CHEBYSHEV_LANCZOS_STEPS, &lambdaMin, &lambdaMax);
+   chebLambdaMin = lambdaMin;
+   chebLambdaMax = 1.05 * lambdaMax;
+
+   printf("Chebyshev preconditioner has degree %d. Eigenvalues of D^-1 Z are estimated to be in [%g, %g].\n",
+          chebDegree, chebLambdaMin, chebLambdaMax);
+
+}  // End of function chebyshevSetup()
+
+
+
+
+
+//========================================================================
+void chebyshevApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = p(D^-1 Z) D^-1 r
+
+   chebyshevSmooth(chebA, chebDinv, chebLambdaMin, chebLambdaMax, chebDegree, r, z, 1, chebR, chebD);
+
+}  // End of function chebyshevApply()
+
+
+
+
+
+//========================================================================
+// Additive Schwarz preconditioner
+//========================================================================
+// Pressure nodes are partitioned into subdomains by recursive coordinate
+// bisection, with at least one subdomain per thread. Each subdomain is
+// extended by its strongly connected neighbours (see AMG_STRENGTH_THRESHOLD),
+// which gives the overlap. The diagonal block of [Z] of each extended
+// subdomain is factorized once with a dense Cholesky factorization. The
+// preconditioner is
+//    C^-1 = sum_i R_i^T Z_i^-1 R_i
+// where R_i restricts a vector to subdomain i. Local solves are independent
+// and run in parallel. Each solve writes its own part of a common array,
+// which is then summed node by node, so no two threads write the same entry.
+// Overlap with the full 125 point stencil of [Z] would make the blocks too
+// large, therefore only the strong connections are used.
+
+static const int SCHWARZ_SUBDOMAIN_SIZE = 128;   // Max. number of pressure nodes in a subdomain before the overlap is added
+
+static int     asNblocks;
+static int    *asBlockStarts;   // Nodes of block b are asNodes[asBlockStarts[b]] to asNodes[asBlockStarts[b+1]-1]
+static int    *asNodes;
+static long   *asFactorStarts;  // Dense Cholesky factor of block b starts at asFactor[asFactorStarts[b]]
+static double *asFactor;
+static double *asLocalR;        // Local right hand sides and solutions of all blocks, indexed like asNodes
+static double *asLocalX;
+static int    *asNodeStarts;    // Copies of node i are asLocalX[asNodeCopies[asNodeStarts[i]]] ...
+static int    *asNodeCopies;
+
+
+
+
+//========================================================================
+void schwarzSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Builds the subdomains, adds the overlap and factorizes the blocks. If the
+   // node coordinates are not known, AMG aggregates are used as subdomains.
+
+   int nThreads = omp_get_max_threads();
+   int maxSize = min(SCHWARZ_SUBDOMAIN_SIZE, (n + nThreads - 1) / nThreads);
+
+   int *subdomain = new int[n];
+   int nSubdomains = 0;
+
+   CSRmatrix Z;
+   Z.nRows     = n;
+   Z.nCols     = n;
+   Z.rowStarts = rowStarts;
+   Z.col       = col;
+   Z.value     = value;
+
+   if (pressureCoord != NULL) {
+      int *nodes = new int[n];
+      for (int i = 0; i < n; i++) {
+         nodes[i] = i;
+      }
+      coordinateBisection(nodes, n, maxSize, nSubdomains, subdomain);
+      delete[] nodes;
+   } else {
+      printf("Pressure node coordinates are not known. AMG aggregates are used as the subdomains of additive Schwarz.\n");
+      nSubdomains = amgAggregate(Z, subdomain);
+   }
+
+   // Nodes of each subdomain
+   int *coreStarts = new int[nSubdomains + 1];
+   int *coreNodes  = new int[n];
+   for (int s = 0; s <= nSubdomains; s++) {
+      coreStarts[s] = 0;
+   }
+   for (int i = 0; i < n; i++) {
+      coreStarts[subdomain[i] + 1]++;
+   }
+   for (int s = 0; s < nSubdomains; s++) {
+      coreStarts[s+1] += coreStarts[s];
+   }
+   for (int i = 0; i < n; i++) {
+      coreNodes[coreStarts[subdomain[i]]++] = i;
+   }
+   for (int s = nSubdomains; s > 0; s--) {
+      coreStarts[s] = coreStarts[s-1];
+   }
+   coreStarts[0] = 0;
+
+   // Extended subdomains. First pass counts, second pass fills.
+   asNblocks     = nSubdomains;
+   asBlockStarts = new int[nSubdomains + 1];
+   int *mark = new int[n];
+   for (int pass = 0; pass < 2; pass++) {
+      for (int i = 0; i < n; i++) {
+         mark[i] = -1;
+      }
+      int count = 0;
+      for (int s = 0; s < nSubdomains; s++) {
+         asBlockStarts[s] = count;
+         for (int k = coreStarts[s]; k < coreStarts[s+1]; k++) {
+            int i = coreNodes[k];
+            if (pass == 1) asNodes[count] = i;
+            mark[i] = s;
+            count++;
+         }
+         for (int k = coreStarts[s]; k < coreStarts[s+1]; k++) {
+            int i = coreNodes[k];
+            double maxOffDiag = 0.0;
+            for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+               if (col[j] != i) {
+                  maxOffDiag = max(maxOffDiag, fabs(value[j]));
+               }
+            }
+            for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+               int c = col[j];
+               if (mark[c] != s && fabs(value[j]) >= AMG_STRENGTH_THRESHOLD * maxOffDiag) {
+                  if (pass == 1) asNodes[count] = c;
+                  mark[c] = s;
+                  count++;
+               }
+            }
+         }
+      }
+      asBlockStarts[nSubdomains] = count;
+      if (pass == 0) {
+         asNodes = new int[count];
+      }
+   }
+   delete[] subdomain;
+   delete[] coreStarts;
+   delete[] coreNodes;
+
+   int nCopies = asBlockStarts[nSubdomains];
+   asLocalR = new double[nCopies];
+   asLocalX = new double[nCopies];
+
+   // Copies of each node, used to sum the local solutions
+   asNodeStarts = new int[n + 1];
+   asNodeCopies = new int[nCopies];
+   for (int i = 0; i <= n; i++) {
+      asNodeStarts[i] = 0;
+   }
+   for (int k = 0; k < nCopies; k++) {
+      asNodeStarts[asNodes[k] + 1]++;
+   }
+   for (int i = 0; i < n; i++) {
+      asNodeStarts[i+1] += asNodeStarts[i];
+   }
+   for (int k = 0; k < nCopies; k++) {
+      asNodeCopies[asNodeStarts[asNodes[k]]++] = k;
+   }
+   for (int i = n; i > 0; i--) {
+      asNodeStarts[i] = asNodeStarts[i-1];
+   }
+   asNodeStarts[0] = 0;
+
+   asFactorStarts = new long[nSubdomains + 1];
+   asFactorStarts[0] = 0;
+   int maxBlock = 0;
+   for (int s = 0; s < nSubdomains; s++) {
+      long m = asBlockStarts[s+1] - asBlockStarts[s];
+      asFactorStarts[s+1] = asFactorStarts[s] + m * m;
+      maxBlock = max(maxBlock, (int) m);
+   }
+   asFactor = new double[asFactorStarts[nSubdomains]];
+
+   // Blocks are extracted and factorized in parallel
+   #pragma omp parallel
+   {
+      int *local = new int[n];
+      for (int i = 0; i < n; i++) {
+         local[i] = -1;
+      }
+      CSRmatrix B = csrAllocate(maxBlock, maxBlock, maxBlock * maxBlock);
+
+      #pragma omp for schedule(dynamic)
+      for (int s = 0; s < nSubdomains; s++) {
+         int m = asBlockStarts[s+1] - asBlockStarts[s];
+         int *nodes = asNodes + asBlockStarts[s];
+         for (int k = 0; k < m; k++) {
+            local[nodes[k]] = k;
+         }
+
+         B.nRows = m;
+         B.nCols = m;
+         int nnz = 0;
+         for (int k = 0; k < m; k++) {
+            B.rowStarts[k] = nnz;
+            int i = nodes[k];
+            for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+               if (local[col[j]] >= 0) {
+                  B.col[nnz]   = local[col[j]];
+                  B.value[nnz] = value[j];
+                  nnz++;
+               }
+            }
+         }
+         B.rowStarts[m] = nnz;
+
+         denseCholesky(B, asFactor + asFactorStarts[s]);
+
+         for (int k = 0; k < m; k++) {
+            local[nodes[k]] = -1;
+         }
+      }
+
+      delete[] local;
+      csrFree(B);
+   }
+
+   printf("Additive Schwarz preconditioner has %d subdomains of on average %.1f nodes, including the overlap.\n",
+          nSubdomains, (double) nCopies / nSubdomains);
+
+}  // End of function schwarzSetup()
+
+
+
+
+
+//========================================================================
+void schwarzApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = sum_i R_i^T Z_i^-1 R_i r
+
+   #pragma omp parallel
+   {
+      #pragma omp for schedule(dynamic)
+      for (int s = 0; s < asNblocks; s++) {
+         int first = asBlockStarts[s];
+         int m = asBlockStarts[s+1] - first;
+         for (int k = first; k < first + m; k++) {
+            asLocalR[k] = r[asNodes[k]];
+         }
+         denseCholeskySolve(m, asFactor + asFactorStarts[s], asLocalR + first, asLocalX + first);
+      }
+
+      #pragma omp for schedule(static)
+      for (int i = 0; i < n; i++) {
+         double sum = 0.0;
+         for (int k = asNodeStarts[i]; k < asNodeStarts[i+1]; k++) {
+            sum += asLocalX[asNodeCopies[k]];
+         }
+         z[i] = sum;
+      }
+   }
+
+}  // End of function schwarzApply()
+
+
+
+
+
+//========================================================================
+// Factorized sparse approximate inverse preconditioner, FSAI
+//========================================================================
+// Z^-1 is approximated by G^T G, where G is lower triangular with a
+// prescribed sparsity pattern. Row i of G is found from the small dense
+// system Z(P_i, P_i) g = e_i, where P_i is the pattern of that row, and is
+// then scaled by 1 / sqrt(g_ii). Rows are independent, so the setup is
+// parallel. Applying the preconditioner is two sparse matrix vector
+// multiplications, y = G r and z = G^T y. G^T is stored explicitly so that
+// both are row by row products without scattered writes. The pattern is
+// either the lower triangle of [Z], which has up to 63 entries per row for
+// the 125 point stencil, or the lower triangle of S^2, where S is the
+// pattern of the strong connections of [Z] (see AMG_STRENGTH_THRESHOLD).
+// The square of the full pattern of [Z] would need dense systems of
+// several hundred unknowns per row.
+
+static int       fsaiPattern = 1;   // 1: Lower triangle of Z, 2: Lower triangle of S^2. Set by setFSAIPattern().
+static CSRmatrix fsaiG, fsaiGT;
+static double   *fsaiY;             // y = G r
+
+
+
+
+//========================================================================
+void setFSAIPattern(int pattern)
+//========================================================================
+{
+   // Selects the sparsity pattern of the FSAI preconditioner. Must be called
+   // before setupPressureSolver().
+
+   if (pattern != 1 && pattern != 2) {
+      printf("WARNING: Unknown FSAI pattern %d. Pattern of Z is used.\n", pattern);
+      pattern = 1;
+   }
+   fsaiPattern = pattern;
+
+}  // End of function setFSAIPattern()
+
+
+
+
+
+//========================================================================
+void fsaiSetup(int n, int *rowStarts, int *col, double *value)
+//========================================================================
+{
+   // Builds the pattern of G and calculates its rows.
+
+   CSRmatrix Z;
+   Z.nRows     = n;
+   Z.nCols     = n;
+   Z.rowStarts = rowStarts;
+   Z.col       = col;
+   Z.value     = value;
+
+   CSRmatrix P = Z;   // Pattern, its values are not used
+   if (fsaiPattern == 2) {
+      CSRmatrix S = csrAllocate(n, n, rowStarts[n]);
+      int nnz = 0;
+      for (int i = 0; i < n; i++) {
+         S.rowStarts[i] = nnz;
+         double maxOffDiag = 0.0;
+         for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+            if (col[j] != i) {
+               maxOffDiag = max(maxOffDiag, fabs(value[j]));
+            }
+         }
+         for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+            if (col[j] == i || fabs(value[j]) >= AMG_STRENGTH_THRESHOLD * maxOffDiag) {
+               S.col[nnz]   = col[j];
+               S.value[nnz] = 1.0;
+               nnz++;
+            }
+         }
+      }
+      S.rowStarts[n] = nnz;
+      P = csrMatMat(S, S);
+      csrFree(S);
+   }
+
+   // Lower triangle of the pattern. Columns of each row are sorted, so the
+   // diagonal is the last entry.
+   int nnz = 0;
+   for (int i = 0; i < n; i++) {
+      for (int j = P.rowStarts[i]; j < P.rowStarts[i+1]; j++) {
+         if (P.col[j] <= i) {
+            nnz++;
+         }
+      }
+   }
+   fsaiG = csrAllocate(n, n, nnz);
+   int maxRow = 0;
+   nnz = 0;
+   for (int i = 0; i < n; i++) {
+      fsaiG.rowStarts[i] = nnz;
+      for (int j = P.rowStarts[i]; j < P.rowStarts[i+1]; j++) {
+         if (P.col[j] <= i) {
+            fsaiG.col[nnz++] = P.col[j];
+         }
+      }
+      csrSortRow(fsaiG.col + fsaiG.rowStarts[i], fsaiG.value + fsaiG.rowStarts[i], nnz - fsaiG.rowStarts[i]);
+      maxRow = max(maxRow, nnz - fsaiG.rowStarts[i]);
+   }
+   fsaiG.rowStarts[n] = nnz;
+   if (fsaiPattern == 2) {
+      csrFree(P);
+   }
+
+   // Rows of G
+   #pragma omp parallel
+   {
+      int *local = new int[n];
+      for (int i = 0; i < n; i++) {
+         local[i] = -1;
+      }
+      CSRmatrix B = csrAllocate(maxRow, maxRow, maxRow * maxRow);
+      double *L = new double[maxRow * maxRow];
+      double *e = new double[maxRow];
+
+      #pragma omp for schedule(dynamic, 64)
+      for (int i = 0; i < n; i++) {
+         int first = fsaiG.rowStarts[i];
+         int m = fsaiG.rowStarts[i+1] - first;
+         int *nodes = fsaiG.col + first;
+         for (int k = 0; k < m; k++) {
+            local[nodes[k]] = k;
+         }
+
+         B.nRows = m;
+         B.nCols = m;
+         int count = 0;
+         for (int k = 0; k < m; k++) {
+            B.rowStarts[k] = count;
+            int r = nodes[k];
+            for (int j = rowStarts[r]; j < rowStarts[r+1]; j++) {
+               if (local[col[j]] >= 0) {
+                  B.col[count]   = local[col[j]];
+                  B.value[count] = value[j];
+                  count++;
+               }
+            }
+         }
+         B.rowStarts[m] = count;
+
+         for (int k = 0; k < m; k++) {
+            e[k] = 0.0;
+         }
+         e[m-1] = 1.0;
+         denseCholesky(B, L);
+         denseCholeskySolve(m, L, e, fsaiG.value + first);
+
+         double gii = fsaiG.value[first + m - 1];
+         double scale = (gii > 0.0) ? 1.0 / sqrt(gii) : 0.0;
+         for (int k = 0; k < m; k++) {
+            fsaiG.value[first + k] *= scale;
+         }
+
+         for (int k = 0; k < m; k++) {
+            local[nodes[k]] = -1;
+         }
+      }
+
+      delete[] local;
+      delete[] L;
+      delete[] e;
+      csrFree(B);
+   }
+
+   fsaiGT = csrTranspose(fsaiG);
+   fsaiY  = new double[n];
+
+   printf("FSAI preconditioner has %.1f nonzeros per row of G.\n", (double) nnz / n);
+
+}  // End of function fsaiSetup()
+
+
+
+
+
+//========================================================================
+void fsaiApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = G^T G r
+
+   csrMultiply(fsaiG,  r,     fsaiY);
+   csrMultiply(fsaiGT, fsaiY, z);
+
+}  // End of function fsaiApply()
+
+
+
+
+
+// Available preconditioners. Index of this array is the pressurePreconditioner
+// setting of the input file.
+static Preconditioner preconditioners[] = {
+   {"none",   noPreconditionerSetup, noPreconditionerApply},    // 0
+   {"Jacobi", jacobiSetup,           jacobiApply},              // 1
+   {"AMG",    amgSetup,              mgApply},                  // 2
+   {"GMG",    gmgSetup,              mgApply},                  // 3
+   {"IC(0)",  icSetup,               icApply},                  // 4
+   {"Deflation", deflationSetup,     mgApply},                  // 5
+   {"Chebyshev", chebyshevSetup,     chebyshevApply},           // 6
+   {"Additive Schwarz", schwarzSetup, schwarzApply},            // 7
+   {"FSAI",   fsaiSetup,             fsaiApply},                // 8
+};
+static const int nPreconditioners = sizeof(preconditioners) / sizeof(preconditioners[0]);
+
+// When [Z] is singular with the constant pressure in its null space, the
+// selected preconditioner is wrapped so that the constant is removed from its
+// output. Search directions of the iterative solvers, and therefore the
+// updates of the solution, are then orthogonal to the null space.
+static bool            projectNullSpace = 0;
+static Preconditioner *unprojectedPrecond;
+static Preconditioner  projectedPrecond;
+
+
+
+
+//========================================================================
+void setPressureNullSpaceProjection(bool project)
+//========================================================================
+{
+   // Turns the null space projection on or off. Must be called before
+   // setupPressureSolver().
+
+   projectNullSpace = project;
+
+}  // End of function setPressureNullSpaceProjection()
+
+
+
+
+
+//========================================================================
+void projectedPreconditionerApply(int n, double *r, double *z)
+//========================================================================
+{
+   // z = P C^-1 r, where P removes the mean
+
+   unprojectedPrecond->apply(n, r, z);
+
+   double mean = 0.0;
+   #pragma omp parallel for simd schedule(static) reduction(+:mean)
+   for (int i = 0; i < n; i++) {
+      mean += z[i];
+   }
+   mean = mean / n;
+
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      z[i] -= mean;
+   }
+
+}  // End of function projectedPreconditionerApply()
+
+
+
+
+
+//========================================================================
+bool setupPressureSolver(int n, int *rowStarts, int *col, double *value, int whichPreconditioner, double **nodeCoord)
+//========================================================================
+{
+   // Keeps a reference to [Z], allocates the work vectors of the solvers and
+   // sets up the selected preconditioner. nodeCoord are the coordinates of
+   // the pressure nodes, which are used by geometric preconditioners.
+   // Returns 0 if the preconditioner number is not valid.
+
+   if (whichPreconditioner < 0 || whichPreconditioner >= nPreconditioners) {
+      printf("ERROR: Unknown pressure preconditioner %d.\n", whichPreconditioner);
+      return 0;
+   }
+
+   if (Zoperator != NULL && whichPreconditioner > 1) {
+      printf("ERROR: Pressure preconditioner %d needs the assembled [Z], which is not available in the matrix-free mode.\n", whichPreconditioner);
+      return 0;
+   }
+
+   Zn            = n;
+   pressureCoord = nodeCoord;
+   ZrowStarts    = rowStarts;
+   Zcol          = col;
+   Zvalue        = value;
+
+   cgR = new double[n];
+   cgZ = new double[n];
+   cgP = new double[n];
+   cgQ = new double[n];
+
+   precond = &preconditioners[whichPreconditioner];
+   precond->setup(n, rowStarts, col, value);
+
+   if (projectNullSpace) {
+      unprojectedPrecond     = precond;
+      projectedPrecond       = *precond;
+      projectedPrecond.apply = projectedPreconditionerApply;
+      precond = &projectedPrecond;
+   }
+
+   printf("Pressure preconditioner is %s.\n", precond->name);
+
+   return 1;
+
+}  // End of function setupPressureSolver()
+
+
+
+
+
+//========================================================================
+int solvePressurePCG(double *b, double *x, double tolerance, int maxIter, double *relResidual)
+//========================================================================
+{
+   // Solves [Z]{x} = {b} with the preconditioned conjugate gradient method.
+   // Incoming x is used as the initial guess. Iterations stop when
+   // ||r|| <= tolerance * ||b|| or after maxIter iterations. Returns the
+   // number of iterations and the final relative residual ||r|| / ||b||.
+   // A negative return value means that the tolerance is not reached.
+
+   int n = Zn;
+
+   double bNormSqr = vectorDot(n, b, b);
+   if (bNormSqr == 0.0) {   // Solution is zero
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+      }
+      *relResidual = 0.0;
+      return 0;
+   }
+
+   double stopSqr = tolerance * tolerance * bNormSqr;
+
+   // r = b - Z * x
+   zMultiplyDot(n, x, cgQ);
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      cgR[i] = b[i] - cgQ[i];
+   }
+   double rNormSqr = vectorDot(n, cgR, cgR);
+
+   precond->apply(n, cgR, cgZ);
+   double rho = vectorDot(n, cgR, cgZ);
+   vectorCopy(n, cgZ, cgP);
+
+   int iter = 0;
+   while (rNormSqr > stopSqr && iter < maxIter) {
+      iter++;
+
+      double pq = zMultiplyDot(n, cgP, cgQ);   // q = Z * p
+      double alpha = rho / pq;
+
+      rNormSqr = cgUpdate(n, alpha, cgP, cgQ, x, cgR);
+      if (rNormSqr <= stopSqr) {
+         break;
+      }
+
+      precond->apply(n, cgR, cgZ);
+      double rhoNew = vectorDot(n, cgR, cgZ);
+      double beta = rhoNew / rho;
+      rho = rhoNew;
+
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         cgP[i] = cgZ[i] + beta * cgP[i];
+      }
+   }
+
+   *relResidual = sqrt(rNormSqr / bNormSqr);
+
+   if (rNormSqr > stopSqr) {
+      return -iter;
+   }
+   return iter;
+
+}  // End of function solvePressurePCG()
+
+
+
+
+
+//========================================================================
+int solvePressureRichardson(double *b, double *x, double tolerance, int maxIter, double *relResidual)
+//========================================================================
+{
+   // Solves [Z]{x} = {b} by the stationary iteration x = x + C^-1 (b - Z x),
+   // where C is the selected preconditioner. With a multigrid preconditioner
+   // this is the standalone multigrid solver, each iteration being a single
+   // V-cycle. Arguments and the return value are the same as the ones of
+   // solvePressurePCG(). The iteration converges only if C is a good enough
+   // approximation of [Z], which is not the case e.g. for Jacobi. It stops
+   // as soon as the residual grows, so that a diverging solve returns a
+   // failure without running maxIter iterations.
+
+   int n = Zn;
+
+   double bNormSqr = vectorDot(n, b, b);
+   if (bNormSqr == 0.0) {   // Solution is zero
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+      }
+      *relResidual = 0.0;
+      return 0;
+   }
+
+   double stopSqr = tolerance * tolerance * bNormSqr;
+   double rNormSqr, rNormSqrPrev = 0.0;
+
+   int iter = 0;
+   while (1) {
+      // r = b - Z * x
+      zMultiplyDot(n, x, cgQ);
+      rNormSqr = 0.0;
+      #pragma omp parallel for simd schedule(static) reduction(+:rNormSqr)
+      for (int i = 0; i < n; i++) {
+         cgR[i] = b[i] - cgQ[i];
+         rNormSqr += cgR[i] * cgR[i];
+      }
+
+      if (rNormSqr <= stopSqr || iter == maxIter) {
+         break;
+      }
+      if (iter > 0 && !(rNormSqr < rNormSqrPrev)) {   // Diverging. Also catches NaN.
+         break;
+      }
+      rNormSqrPrev = rNormSqr;
+      iter++;
+
+      precond->apply(n, cgR, cgZ);
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         x[i] += cgZ[i];
+      }
+   }
+
+   *relResidual = sqrt(rNormSqr / bNormSqr);
+
+   if (rNormSqr > stopSqr) {
+      return -iter;
+   }
+   return iter;
+
+}  // End of function solvePressureRichardson()
+
+
+
+
+
+//========================================================================
+// Communication avoiding CG variants
+//========================================================================
+// Standard PCG has two separate reductions, i.e. synchronization points of
+// all threads, per iteration. Pipelined PCG of Ghysels and Vanroose has a
+// single reduction per iteration, which is fused with the multiplication
+// by [Z] of the same iteration. s-step CG does s iterations with a single
+// reduction, the Gram matrix of a Krylov basis of s steps. Its basis is
+// built with the Jacobi scaled matrix D^-1/2 Z D^-1/2, which is its
+// preconditioning. It does not use the selected preconditioner.
+
+static double *pipeM, *pipeN, *pipeZ, *pipeQ, *pipeS;   // Work vectors of the pipelined PCG
+
+static const int SSTEP_MAX_STEPS = 8;    // Max. number of steps s of s-step CG. Scaled monomial basis loses its accuracy for larger s.
+
+static int      sstepS;             // Number of steps s of s-step CG
+static double **sstepY;             // Basis [p, Ap, ..., A^s p, r, Ar, ..., A^(s-1) r], A = D^-1/2 Z D^-1/2
+static double  *sstepNewP, *sstepNewR;   // p and r at the end of an outer iteration
+static double  *sstepDinvSqrt;      // D^-1/2
+static double  *sstepGram;          // Gram matrix of the basis, Y^T Y
+static double   sstepSigma;         // Scale of the monomial basis, an upper bound of the eigenvalues of A
+
+
+
+
+//========================================================================
+void setupPressureCGVariant(int variant, int s)
+//========================================================================
+{
+   // Allocates the work space of the pipelined (variant 1) or the s-step
+   // (variant 2) CG. Must be called after setupPressureSolver().
+
+   int n = Zn;
+
+   if (variant == 1) {
+      pipeM = new double[n];
+      pipeN = new double[n];
+      pipeZ = new double[n];
+      pipeQ = new double[n];
+      pipeS = new double[n];
+   } else if (variant == 2) {
+      sstepS = max(1, min(s, SSTEP_MAX_STEPS));
+      if (sstepS != s) {
+         printf("WARNING: Number of steps of s-step CG is changed from %d to %d.\n", s, sstepS);
+      }
+      int nBasis = 2 * sstepS + 1;
+      sstepY = new double*[nBasis];
+      for (int k = 0; k < nBasis; k++) {
+         sstepY[k] = new double[n];
+      }
+      sstepNewP     = new double[n];
+      sstepNewR     = new double[n];
+      sstepDinvSqrt = new double[n];
+      sstepGram     = new double[nBasis * nBasis];
+
+      for (int i = 0; i < n; i++) {
+         for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+            if (Zcol[j] == i) {
+               sstepDinvSqrt[i] = 1.0 / sqrt(Zvalue[j]);
+            }
+         }
+      }
+
+      // Gershgorin bound of the eigenvalues of D^-1/2 Z D^-1/2
+      sstepSigma = 0.0;
+      for (int i = 0; i < n; i++) {
+         double sum = 0.0;
+         for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+            sum += fabs(Zvalue[j]) * sstepDinvSqrt[i] * sstepDinvSqrt[Zcol[j]];
+         }
+         sstepSigma = max(sstepSigma, sum);
+      }
+   }
+
+}  // End of function setupPressureCGVariant()
+
+
+
+
+
+//========================================================================
+int solvePressurePipelinedCG(double *b, double *x, double tolerance, int maxIter, double *relResidual)
+//========================================================================
+{
+   // Solves [Z]{x} = {b} with the pipelined PCG of Ghysels and Vanroose.
+   // Three dot products of an iteration are calculated in a single reduction,
+   // in the same pass that multiplies the preconditioned w with [Z].
+   // Arguments and the return value are the same as the ones of
+   // solvePressurePCG(). Convergence is detected one iteration later than in
+   // solvePressurePCG(), because the residual norm is part of the fused
+   // reduction.
+
+   int n = Zn;
+   double *r = cgR;
+   double *u = cgZ;
+   double *p = cgP;
+   double *w = cgQ;
+
+   double bNormSqr = vectorDot(n, b, b);
+   if (bNormSqr == 0.0) {   // Solution is zero
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+      }
+      *relResidual = 0.0;
+      return 0;
+   }
+
+   double stopSqr = tolerance * tolerance * bNormSqr;
+
+   // r = b - Z x, u = C^-1 r, w = Z u
+   zMultiplyDot(n, x, w);
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      r[i] = b[i] - w[i];
+   }
+   precond->apply(n, r, u);
+   zMultiplyDot(n, u, w);
+
+   double gammaOld = 0.0;
+   double alphaOld = 0.0;
+   double rNormSqr;
+
+   int iter = 0;
+   while (1) {
+      // m = C^-1 w
+      precond->apply(n, w, pipeM);
+
+      // nv = Z m, together with gamma = r.u, delta = w.u and r.r
+      double gamma = 0.0;
+      double delta = 0.0;
+      rNormSqr = 0.0;
+      #pragma omp parallel for schedule(static) reduction(+:gamma,delta,rNormSqr)
+      for (int i = 0; i < n; i++) {
+         double Zm = 0.0;
+         for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+            Zm += Zvalue[j] * pipeM[Zcol[j]];
+         }
+         pipeN[i] = Zm;
+         gamma    += r[i] * u[i];
+         delta    += w[i] * u[i];
+         rNormSqr += r[i] * r[i];
+      }
+
+      if (rNormSqr <= stopSqr || iter == maxIter) {
+         break;
+      }
+
+      double alpha, beta;
+      if (iter == 0) {
+         beta  = 0.0;
+         alpha = gamma / delta;
+      } else {
+         beta  = gamma / gammaOld;
+         alpha = gamma / (delta - beta * gamma / alphaOld);
+      }
+      gammaOld = gamma;
+      alphaOld = alpha;
+      iter++;
+
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         pipeZ[i] = pipeN[i] + beta * pipeZ[i];
+         pipeQ[i] = pipeM[i] + beta * pipeQ[i];
+         pipeS[i] = w[i]     + beta * pipeS[i];
+         p[i]     = u[i]     + beta * p[i];
+         x[i] += alpha * p[i];
+         r[i] -= alpha * pipeS[i];
+         u[i] -= alpha * pipeQ[i];
+         w[i] -= alpha * pipeZ[i];
+      }
+   }
+
+   *relResidual = sqrt(rNormSqr / bNormSqr);
+
+   if (rNormSqr > stopSqr) {
+      return -iter;
+   }
+   return iter;
+
+}  // End of function solvePressurePipelinedCG()
+
+
+
+
+
+//========================================================================
+void sstepApplyB(int s, double sigma, double *c, double *Bc)
+//========================================================================
+{
+   // Bc = B c, where B gives A Y = Y B for the coordinates c of a vector in
+   // the scaled monomial basis Y of s-step CG. Coordinates of the highest
+   // powers of the two blocks of the basis must be zero.
+
+   for (int k = 0; k < 2*s + 1; k++) {
+      Bc[k] = 0.0;
+   }
+   for (int k = 0; k < s; k++) {        // p block, A^k p -> sigma * A^(k+1) p / sigma^(k+1)
+      Bc[k+1] += sigma * c[k];
+   }
+   for (int k = s + 1; k < 2*s; k++) {  // r block
+      Bc[k+1] += sigma * c[k];
+   }
+
+}  // End of function sstepApplyB()
+
+
+
+
+
+//========================================================================
+double sstepGramProduct(int nBasis, double *G, double *a, double *c)
+//========================================================================
+{
+   // Returns a^T G c
+
+   double sum = 0.0;
+   for (int k = 0; k < nBasis; k++) {
+      for (int l = 0; l < nBasis; l++) {
+         sum += a[k] * G[k * nBasis + l] * c[l];
+      }
+   }
+   return sum;
+
+}  // End of function sstepGramProduct()
+
+
+
+
+
+//========================================================================
+int solvePressureSstepCG(double *b, double *x, double tolerance, int maxIter, double *relResidual)
+//========================================================================
+{
+   // Solves [Z]{x} = {b} with s-step CG (CA-CG of Hoemmen and Carson) on
+   // the Jacobi scaled system A xs = bs, A = D^-1/2 Z D^-1/2,
+   // x = D^-1/2 xs, bs = D^-1/2 b. Each outer iteration builds the basis Y of
+   // s steps with 2s-1 multiplications by A, calculates its Gram matrix and
+   // the true residual norm in a single reduction, and does s CG
+   // iterations on the coordinates in that basis, without touching vectors
+   // of size n. Basis is the monomial basis scaled by an eigenvalue bound.
+   // Arguments and the return value are the same as the ones of
+   // solvePressurePCG(). Convergence is checked every s iterations. If the
+   // residual grows during an outer iteration the basis has lost its
+   // accuracy, and the solve stops with a failure.
+
+   int n = Zn;
+   int s = sstepS;
+   int nBasis = 2 * s + 1;
+   double sigma = sstepSigma;
+   double *dis = sstepDinvSqrt;
+
+   double bNormSqr = vectorDot(n, b, b);
+   if (bNormSqr == 0.0) {   // Solution is zero
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+      }
+      *relResidual = 0.0;
+      return 0;
+   }
+
+   double stopSqr = tolerance * tolerance * bNormSqr;
+
+   // Scaled residual rs = D^-1/2 (b - Z x), which is also the first p
+   zMultiplyDot(n, x, cgQ);
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      double rs = dis[i] * (b[i] - cgQ[i]);
+      sstepY[0][i]     = rs;
+      sstepY[s + 1][i] = rs;
+   }
+
+   // Coordinates of p, r, x and B p in the basis
+   double pc[2*SSTEP_MAX_STEPS + 1], rc[2*SSTEP_MAX_STEPS + 1], xc[2*SSTEP_MAX_STEPS + 1], Bp[2*SSTEP_MAX_STEPS + 1];
+
+   double rNormSqr, rNormSqrPrev = 0.0;
+   int iter = 0;
+
+   while (1) {
+      // Basis vectors, Y[k+1] = A Y[k] / sigma for both blocks
+      for (int k = 0; k < s; k++) {
+         for (int block = 0; block < 2; block++) {
+            if (block == 1 && k == s - 1) {
+               break;
+            }
+            double *v  = sstepY[block * (s + 1) + k];
+            double *Av = sstepY[block * (s + 1) + k + 1];
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < n; i++) {
+               double sum = 0.0;
+               for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+                  sum += Zvalue[j] * dis[Zcol[j]] * v[Zcol[j]];
+               }
+               Av[i] = dis[i] * sum / sigma;
+            }
+         }
+      }
+
+      // Gram matrix and the norm of the true residual r = D^1/2 rs, in a
+      // single reduction
+      for (int k = 0; k < nBasis * nBasis; k++) {
+         sstepGram[k] = 0.0;
+      }
+      rNormSqr = 0.0;
+      #pragma omp parallel reduction(+:rNormSqr)
+      {
+         double G[(2*SSTEP_MAX_STEPS + 1) * (2*SSTEP_MAX_STEPS + 1)];
+         for (int k = 0; k < nBasis * nBasis; k++) {
+            G[k] = 0.0;
+         }
+         #pragma omp for schedule(static)
+         for (int i = 0; i < n; i++) {
+            for (int k = 0; k < nBasis; k++) {
+               double yk = sstepY[k][i];
+               for (int l = k; l < nBasis; l++) {
+                  G[k * nBasis + l] += yk * sstepY[l][i];
+               }
+            }
+            double rs = sstepY[s + 1][i];
+            rNormSqr += rs * rs / (dis[i] * dis[i]);
+         }
+         #pragma omp critical
+         for (int k = 0; k < nBasis; k++) {
+            for (int l = k; l < nBasis; l++) {
+               sstepGram[k * nBasis + l] += G[k * nBasis + l];
+            }
+         }
+      }
+      for (int k = 0; k < nBasis; k++) {
+         for (int l = 0; l < k; l++) {
+            sstepGram[k * nBasis + l] = sstepGram[l * nBasis + k];
+         }
+      }
+
+      if (rNormSqr <= stopSqr || iter >= maxIter) {
+         break;
+      }
+      if (iter > 0 && !(rNormSqr < rNormSqrPrev)) {   // Diverging. Also catches NaN.
+         break;
+      }
+      rNormSqrPrev = rNormSqr;
+
+      // s CG iterations on the coordinates
+      for (int k = 0; k < nBasis; k++) {
+         pc[k] = 0.0;
+         rc[k] = 0.0;
+         xc[k] = 0.0;
+      }
+      pc[0]     = 1.0;
+      rc[s + 1] = 1.0;
+      double rGr = sstepGramProduct(nBasis, sstepGram, rc, rc);
+      int outerStart = iter;
+
+      for (int j = 0; j < s && iter < maxIter; j++) {
+         sstepApplyB(s, sigma, pc, Bp);
+         double pGBp = sstepGramProduct(nBasis, sstepGram, pc, Bp);
+         if (pGBp <= 0.0 || rGr <= 0.0) {   // Basis lost its accuracy, restart with the current vectors
+            break;
+         }
+         double alpha = rGr / pGBp;
+         for (int k = 0; k < nBasis; k++) {
+            xc[k] += alpha * pc[k];
+            rc[k] -= alpha * Bp[k];
+         }
+         double rGrNew = sstepGramProduct(nBasis, sstepGram, rc, rc);
+         double beta = rGrNew / rGr;
+         rGr = rGrNew;
+         for (int k = 0; k < nBasis; k++) {
+            pc[k] = rc[k] + beta * pc[k];
+         }
+         iter++;
+      }
+
+      // x = x + D^-1/2 Y xc, rs = Y rc, p = Y pc
+      #pragma omp parallel for schedule(static)
+      for (int i = 0; i < n; i++) {
+         double dx = 0.0;
+         double rs = 0.0;
+         double ps = 0.0;
+         for (int k = 0; k < nBasis; k++) {
+            double yk = sstepY[k][i];
+            dx += xc[k] * yk;
+            rs += rc[k] * yk;
+            ps += pc[k] * yk;
+         }
+         x[i] += dis[i] * dx;
+         sstepNewR[i] = rs;
+         sstepNewP[i] = ps;
+      }
+
+      double *tmp;
+      tmp = sstepY[0];     sstepY[0]     = sstepNewP; sstepNewP = tmp;
+      tmp = sstepY[s + 1]; sstepY[s + 1] = sstepNewR; sstepNewR = tmp;
+
+      if (iter == outerStart) {   // No progress is possible with this basis
+         break;
+      }
+   }
+
+   *relResidual = sqrt(rNormSqr / bNormSqr);
+
+   if (rNormSqr > stopSqr) {
+      return -iter;
+   }
+   return iter;
+
+}  // End of function solvePressureSstepCG()
+
+
+
+
+
+//========================================================================
+// Krylov subspace recycling
+//========================================================================
+// [Z] is the same in all solves, so the eigenvectors of its smallest
+// eigenvalues, which slow down CG, are the same too. Deflated PCG of Saad,
+// Yeung, Erhel and Guyomarc'h keeps the iterations Z-orthogonal to the
+// columns of W, which approximate these eigenvectors. During the first
+// solves the first search directions P of each solve are stored. After
+// each of these solves W is replaced by the harmonic Ritz vectors of the
+// smallest harmonic Ritz values of [Z] in the span of [W P]. Later solves
+// use a fixed W. W is kept Z-orthonormal, so W^T Z W = I and no coarse
+// matrix needs to be factorized.
+
+static const int RECYCLE_MAX_VECTORS = 32;   // Max. number of recycled vectors
+
+static int      recycleK;            // Requested number of recycled vectors
+static int      recycleN;            // Number of recycled vectors that are available
+static int      recycleNdirections;  // Number of search directions stored in a solve, 2 * recycleK
+static int      recycleNstored;      // Number of search directions stored in the current solve
+static int      recycleSolvesLeft;   // Number of solves that will still update W
+static double **recycleW, **recycleZW;       // W and Z W
+static double **recycleP, **recycleZP;       // Stored search directions and their Z images
+static double **recycleNewW, **recycleNewZW; // Updated W and Z W
+static double  *recycleF, *recycleG;         // S^T Z S and (Z S)^T (Z S) of recycleUpdate()
+static double  *recycleU, *recycleB, *recycleC, *recycleLambda;   // Work arrays of recycleUpdate()
+
+
+
+
+//========================================================================
+void setupPressureRecycling(int nVectors, int nSolves)
+//========================================================================
+{
+   // Allocates the recycled vectors. W is refined during the first nSolves
+   // solves. Must be called after setupPressureSolver().
+
+   int n = Zn;
+
+   recycleK = max(1, min(nVectors, RECYCLE_MAX_VECTORS));
+   if (recycleK != nVectors) {
+      printf("WARNING: Number of recycled vectors is changed from %d to %d.\n", nVectors, recycleK);
+   }
+   recycleNdirections = 2 * recycleK;
+   recycleN           = 0;
+   recycleNstored     = 0;
+   recycleSolvesLeft  = nSolves;
+
+   recycleW     = new double*[recycleK];
+   recycleZW    = new double*[recycleK];
+   recycleNewW  = new double*[recycleK];
+   recycleNewZW = new double*[recycleK];
+   for (int k = 0; k < recycleK; k++) {
+      recycleW[k]     = new double[n];
+      recycleZW[k]    = new double[n];
+      recycleNewW[k]  = new double[n];
+      recycleNewZW[k] = new double[n];
+   }
+
+   recycleP  = new double*[recycleNdirections];
+   recycleZP = new double*[recycleNdirections];
+   for (int k = 0; k < recycleNdirections; k++) {
+      recycleP[k]  = new double[n];
+      recycleZP[k] = new double[n];
+   }
+
+   // Dense matrices of recycleUpdate(). S = [W P] has at most 3 * recycleK
+   // columns. They are allocated here so that no allocation is done in the
+   // time loop.
+   int mMax = recycleK + recycleNdirections;
+   recycleF      = new double[mMax * mMax];
+   recycleG      = new double[mMax * mMax];
+   recycleU      = new double[mMax * mMax];
+   recycleB      = new double[mMax * mMax];
+   recycleC      = new double[mMax * mMax];
+   recycleLambda = new double[mMax];
+
+}  // End of function setupPressureRecycling()
+
+
+
+
+
+//========================================================================
+double recycleDots(int n, double **V, int k, double *z, double *h, double *r)
+//========================================================================
+{
+   // h[l] = V[l] . z for l < k and, if r is not NULL, returns r . z, all in
+   // a single reduction.
+
+   double rz = 0.0;
+   for (int l = 0; l < k; l++) {
+      h[l] = 0.0;
+   }
+
+   #pragma omp parallel reduction(+:rz)
+   {
+      double hLocal[RECYCLE_MAX_VECTORS];
+      for (int l = 0; l < k; l++) {
+         hLocal[l] = 0.0;
+      }
+
+      #pragma omp for schedule(static)
+      for (int i = 0; i < n; i++) {
+         for (int l = 0; l < k; l++) {
+            hLocal[l] += V[l][i] * z[i];
+         }
+         if (r != NULL) {
+            rz += r[i] * z[i];
+         }
+      }
+
+      #pragma omp critical
+      for (int l = 0; l < k; l++) {
+         h[l] += hLocal[l];
+      }
+   }
+
+   return rz;
+
+}  // End of function recycleDots()
+
+
+
+
+
+//========================================================================
+void denseSymmetricEigen(int m, double *A, double *lambda, double *V)
+//========================================================================
+{
+   // Eigenvalues and eigenvectors of the m x m symmetric matrix A, stored
+   // row by row, by the cyclic Jacobi method. A is destroyed. Column j of V,
+   // V[i*m + j], is the eigenvector of lambda[j]. Eigenvalues are not sorted.
+
+   for (int i = 0; i < m; i++) {
+      for (int j = 0; j < m; j++) {
+         V[i*m + j] = (i == j) ? 1.0 : 0.0;
+      }
+   }
+
+   for (int sweep = 0; sweep < 50; sweep++) {
+      double off = 0.0, diag = 0.0;
+      for (int i = 0; i < m; i++) {
+         diag += A[i*m + i] * A[i*m + i];
+         for (int j = i + 1; j < m; j++) {
+            off += A[i*m + j] * A[i*m + j];
+         }
+      }
+      if (off <= 1e-30 * diag) {
+         break;
+      }
+
+      for (int p = 0; p < m; p++) {
+         for (int q = p + 1; q < m; q++) {
+            double apq = A[p*m + q];
+            if (apq == 0.0) {
+               continue;
+            }
+            // Rotation that zeroes A(p,q)
+            double theta = (A[q*m + q] - A[p*m + p]) / (2.0 * apq);
+            double t = ((theta >= 0.0) ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+            double c = 1.0 / sqrt(t * t + 1.0);
+            double s = t * c;
+
+            for (int k = 0; k < m; k++) {
+               double akp = A[k*m + p], akq = A[k*m + q];
+               A[k*m + p] = c * akp - s * akq;
+               A[k*m + q] = s * akp + c * akq;
+            }
+            for (int k = 0; k < m; k++) {
+               double apk = A[p*m + k], aqk = A[q*m + k];
+               A[p*m + k] = c * apk - s * aqk;
+               A[q*m + k] = s * apk + c * aqk;
+            }
+            for (int k = 0; k < m; k++) {
+               double vkp = V[k*m + p], vkq = V[k*m + q];
+               V[k*m + p] = c * vkp - s * vkq;
+               V[k*m + q] = s * vkp + c * vkq;
+            }
+         }
+      }
+   }
+
+   for (int i = 0; i < m; i++) {
+      lambda[i] = A[i*m + i];
+   }
+
+}  // End of function denseSymmetricEigen()
+
+
+
+
+
+//========================================================================
+void recycleUpdate()
+//========================================================================
+{
+   // Replaces W with the harmonic Ritz vectors of the smallest harmonic Ritz
+   // values of [Z] in the span of S = [W P]. These solve
+   //    (Z S)^T (Z S) y = theta S^T Z S y
+   // S^T Z S is first reduced to the identity with its own eigenvectors,
+   // dropping the directions that are linearly dependent. The vectors
+   // W = S y are then Z-orthonormal.
+
+   int n = Zn;
+   int m = recycleN + recycleNstored;
+
+   if (recycleNstored == 0) {
+      return;
+   }
+
+   double *S[3 * RECYCLE_MAX_VECTORS];    // m <= 3 * recycleK
+   double *ZS[3 * RECYCLE_MAX_VECTORS];
+   for (int c = 0; c < m; c++) {
+      S[c]  = (c < recycleN) ? recycleW[c]  : recycleP[c - recycleN];
+      ZS[c] = (c < recycleN) ? recycleZW[c] : recycleZP[c - recycleN];
+   }
+
+   double *F      = recycleF;   // S^T Z S
+   double *G      = recycleG;   // (Z S)^T (Z S)
+   double *U      = recycleU;
+   double *B      = recycleB;
+   double *C      = recycleC;
+   double *lambda = recycleLambda;
+
+   for (int c = 0; c < m; c++) {
+      for (int d = c; d < m; d++) {
+         F[c*m + d] = F[d*m + c] = 0.5 * (vectorDot(n, S[c], ZS[d]) + vectorDot(n, S[d], ZS[c]));
+         G[c*m + d] = G[d*m + c] = vectorDot(n, ZS[c], ZS[d]);
+      }
+   }
+
+   // Z-orthonormal basis of the span of S, B = U Lambda^-1/2
+   denseSymmetricEigen(m, F, lambda, U);
+   double lambdaMax = 0.0;
+   for (int c = 0; c < m; c++) {
+      lambdaMax = max(lambdaMax, lambda[c]);
+   }
+   int r = 0;
+   for (int c = 0; c < m; c++) {
+      if (lambda[c] > 1e-10 * lambdaMax) {
+         for (int i = 0; i < m; i++) {
+            B[i*m + r] = U[i*m + c] / sqrt(lambda[c]);
+         }
+         r++;
+      }
+   }
+
+   // C = B^T G B, an r x r matrix
+   for (int a = 0; a < r; a++) {
+      for (int b = 0; b < r; b++) {
+         double sum = 0.0;
+         for (int i = 0; i < m; i++) {
+            for (int j = 0; j < m; j++) {
+               sum += B[i*m + a] * G[i*m + j] * B[j*m + b];
+            }
+         }
+         C[a*r + b] = sum;
+      }
+   }
+   denseSymmetricEigen(r, C, lambda, U);   // Eigenvectors are in the first r x r entries of U
+
+   // Vectors of the smallest theta are selected one by one
+   int kNew = min(recycleK, r);
+   bool taken[3 * RECYCLE_MAX_VECTORS];   // r <= m
+   for (int a = 0; a < r; a++) {
+      taken[a] = 0;
+   }
+   double y[3 * RECYCLE_MAX_VECTORS];   // m <= 3 * recycleK
+   for (int l = 0; l < kNew; l++) {
+      int best = -1;
+      for (int a = 0; a < r; a++) {
+         if (!taken[a] && (best < 0 || lambda[a] < lambda[best])) {
+            best = a;
+         }
+      }
+      taken[best] = 1;
+
+      for (int i = 0; i < m; i++) {   // y = B v
+         y[i] = 0.0;
+         for (int a = 0; a < r; a++) {
+            y[i] += B[i*m + a] * U[a*r + best];
+         }
+      }
+
+      double *w  = recycleNewW[l];
+      double *zw = recycleNewZW[l];
+      #pragma omp parallel for schedule(static)
+      for (int i = 0; i < n; i++) {
+         double sumW = 0.0, sumZW = 0.0;
+         for (int c = 0; c < m; c++) {
+            sumW  += y[c] * S[c][i];
+            sumZW += y[c] * ZS[c][i];
+         }
+         w[i]  = sumW;
+         zw[i] = sumZW;
+      }
+   }
+
+   for (int l = 0; l < recycleK; l++) {
+      swap(recycleW[l],  recycleNewW[l]);
+      swap(recycleZW[l], recycleNewZW[l]);
+   }
+   recycleN = kNew;
+   recycleNstored = 0;
+
+}  // End of function recycleUpdate()
+
+
+
+
+
+//========================================================================
+int solvePressureRecycledPCG(double *b, double *x, double tolerance, int maxIter, double *relResidual)
+//========================================================================
+{
+   // Solves [Z]{x} = {b} with deflated PCG using the recycled vectors W.
+   // Arguments and the return value are the same as the ones of
+   // solvePressurePCG(). While W is being refined, the first search
+   // directions are stored and W is updated at the end.
+
+   int n = Zn;
+   int k = recycleN;
+   double h[RECYCLE_MAX_VECTORS];
+
+   double bNormSqr = vectorDot(n, b, b);
+   if (bNormSqr == 0.0) {   // Solution is zero
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+      }
+      *relResidual = 0.0;
+      return 0;
+   }
+
+   double stopSqr = tolerance * tolerance * bNormSqr;
+
+   // r = b - Z * x
+   zMultiplyDot(n, x, cgQ);
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      cgR[i] = b[i] - cgQ[i];
+   }
+
+   // x = x + W W^T r makes r orthogonal to W
+   if (k > 0) {
+      recycleDots(n, recycleW, k, cgR, h, NULL);
+      #pragma omp parallel for schedule(static)
+      for (int i = 0; i < n; i++) {
+         double dx = 0.0, dr = 0.0;
+         for (int l = 0; l < k; l++) {
+            dx += h[l] * recycleW[l][i];
+            dr += h[l] * recycleZW[l][i];
+         }
+         x[i]   += dx;
+         cgR[i] -= dr;
+      }
+   }
+   double rNormSqr = vectorDot(n, cgR, cgR);
+
+   // p = z - W (ZW)^T z
+   precond->apply(n, cgR, cgZ);
+   double rho = recycleDots(n, recycleZW, k, cgZ, h, cgR);
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < n; i++) {
+      double sum = 0.0;
+      for (int l = 0; l < k; l++) {
+         sum += h[l] * recycleW[l][i];
+      }
+      cgP[i] = cgZ[i] - sum;
+   }
+
+   bool store = (recycleSolvesLeft > 0);
+
+   int iter = 0;
+   while (rNormSqr > stopSqr && iter < maxIter) {
+      iter++;
+
+      double pq = zMultiplyDot(n, cgP, cgQ);   // q = Z * p
+      double alpha = rho / pq;
+
+      if (store && recycleNstored < recycleNdirections) {
+         vectorCopy(n, cgP, recycleP[recycleNstored]);
+         vectorCopy(n, cgQ, recycleZP[recycleNstored]);
+         recycleNstored++;
+      }
+
+      rNormSqr = cgUpdate(n, alpha, cgP, cgQ, x, cgR);
+      if (rNormSqr <= stopSqr) {
+         break;
+      }
+
+      precond->apply(n, cgR, cgZ);
+      double rhoNew = recycleDots(n, recycleZW, k, cgZ, h, cgR);
+      double beta = rhoNew / rho;
+      rho = rhoNew;
+
+      #pragma omp parallel for schedule(static)
+      for (int i = 0; i < n; i++) {
+         double sum = 0.0;
+         for (int l = 0; l < k; l++) {
+            sum += h[l] * recycleW[l][i];
+         }
+         cgP[i] = cgZ[i] + beta * cgP[i] - sum;
+      }
+   }
+
+   if (store) {
+      recycleUpdate();
+      recycleSolvesLeft--;
+   }
+
+   *relResidual = sqrt(rNormSqr / bNormSqr);
+
+   if (rNormSqr > stopSqr) {
+      return -iter;
+   }
+   return iter;
+
+}  // End of function solvePressureRecycledPCG()
+
+
+
+
+
+//========================================================================
+// Mixed precision solve
+//========================================================================
+// CG iterations are done in single precision with a float copy of the
+// values of [Z] and of the preconditioner, which halves the bytes read per
+// iteration. Column indices are shared with the double precision [Z]. An
+// outer iterative refinement loop in double precision calculates the true
+// residual, solves for a correction in single precision and adds it to the
+// solution, until the requested tolerance is reached. Each correction only
+// needs to reduce the residual by MIXED_INNER_REDUCTION, which is well
+// above the float round off. The FSAI preconditioner is copied to float.
+// For the other preconditioners Jacobi scaling is used in the inner solves,
+// because they have internal data in double precision.
+
+static const double MIXED_INNER_REDUCTION = 1e-3;   // Residual reduction of each single precision CG solve
+
+static float *mpZvalue;                   // Values of [Z]
+static float *mpDinv;                     // Inverse of the diagonal of [Z], if FSAI is not used
+static float *mpGvalue, *mpGTvalue;       // Values of G and G^T of FSAI
+static float *mpR, *mpZ, *mpP, *mpQ, *mpX, *mpY;   // Work vectors
+
+
+
+
+//========================================================================
+void setupPressureMixedPrecision()
+//========================================================================
+{
+   // Makes the single precision copies. Must be called after
+   // setupPressureSolver().
+
+   int n = Zn;
+   int nnz = ZrowStarts[n];
+
+   // Entries that are round off level in double precision would be denormal
+   // floats, which are very slow to multiply. They are negligible in single
+   // precision and are set to zero.
+   mpZvalue = new float[nnz];
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < n; i++) {
+      double rowMax = 0.0;
+      for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+         rowMax = max(rowMax, fabs(Zvalue[j]));
+      }
+      for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+         mpZvalue[j] = (fabs(Zvalue[j]) > 1e-12 * rowMax) ? (float) Zvalue[j] : 0.0f;
+      }
+   }
+
+   mpGvalue = NULL;
+   mpDinv   = NULL;
+   Preconditioner *selected = projectNullSpace ? unprojectedPrecond : precond;
+   if (selected->apply == fsaiApply) {
+      int nnzG = fsaiG.rowStarts[n];
+      mpGvalue  = new float[nnzG];
+      mpGTvalue = new float[nnzG];
+      for (int j = 0; j < nnzG; j++) {
+         mpGvalue[j]  = (fabs(fsaiG.value[j])  > FLT_MIN) ? (float) fsaiG.value[j]  : 0.0f;
+         mpGTvalue[j] = (fabs(fsaiGT.value[j]) > FLT_MIN) ? (float) fsaiGT.value[j] : 0.0f;
+      }
+      mpY = new float[n];
+      printf("Single precision CG uses the FSAI preconditioner.\n");
+   } else {
+      mpDinv = new float[n];
+      for (int i = 0; i < n; i++) {
+         mpDinv[i] = 0.0f;
+         for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+            if (Zcol[j] == i && Zvalue[j] != 0.0) {
+               mpDinv[i] = (float) (1.0 / Zvalue[j]);
+            }
+         }
+      }
+      printf("Single precision CG uses the Jacobi preconditioner.\n");
+   }
+
+   mpR = new float[n];
+   mpZ = new float[n];
+   mpP = new float[n];
+   mpQ = new float[n];
+   mpX = new float[n];
+
+}  // End of function setupPressureMixedPrecision()
+
+
+
+
+
+//========================================================================
+void mpCsrMultiply(int n, float *value, int *col, int *rowStarts, float *x, float *y)
+//========================================================================
+{
+   // y = A * x in single precision
+
+   #pragma omp parallel for schedule(static)
+   for (int i = 0; i < n; i++) {
+      float sum = 0.0f;
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         sum += value[j] * x[col[j]];
+      }
+      y[i] = sum;
+   }
+
+}  // End of function mpCsrMultiply()
+
+
+
+
+
+//========================================================================
+void mpPreconditionerApply(int n, float *r, float *z)
+//========================================================================
+{
+   // z = C^-1 * r in single precision
+
+   if (mpGvalue != NULL) {
+      mpCsrMultiply(n, mpGvalue,  fsaiG.col,  fsaiG.rowStarts,  r,   mpY);
+      mpCsrMultiply(n, mpGTvalue, fsaiGT.col, fsaiGT.rowStarts, mpY, z);
+   } else {
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         z[i] = mpDinv[i] * r[i];
+      }
+   }
+
+}  // End of function mpPreconditionerApply()
+
+
+
+
+
+//========================================================================
+int mpInnerCG(int n, double reduction, int maxIter)
+//========================================================================
+{
+   // Solves Z x = r in single precision, starting from x = 0, where r and
+   // x are mpR and mpX. Stops when the residual is reduced by the given
+   // factor. Dot products are accumulated in double precision. Returns the
+   // number of iterations.
+
+   double rNormSqr = 0.0;
+   #pragma omp parallel for simd schedule(static) reduction(+:rNormSqr)
+   for (int i = 0; i < n; i++) {
+      mpX[i] = 0.0f;
+      rNormSqr += (double) mpR[i] * mpR[i];
+   }
+   double stopSqr = reduction * reduction * rNormSqr;
+
+   mpPreconditionerApply(n, mpR, mpZ);
+   double rho = 0.0;
+   #pragma omp parallel for simd schedule(static) reduction(+:rho)
+   for (int i = 0; i < n; i++) {
+      mpP[i] = mpZ[i];
+      rho += (double) mpR[i] * mpZ[i];
+   }
+
+   int iter = 0;
+   while (rNormSqr > stopSqr && iter < maxIter) {
+      iter++;
+
+      double pq = 0.0;
+      #pragma omp parallel for schedule(static) reduction(+:pq)
+      for (int i = 0; i < n; i++) {   // q = Z * p
+         float sum = 0.0f;
+         for (int j = ZrowStarts[i]; j < ZrowStarts[i+1]; j++) {
+            sum += mpZvalue[j] * mpP[Zcol[j]];
+         }
+         mpQ[i] = sum;
+         pq += (double) mpP[i] * sum;
+      }
+      float alpha = (float) (rho / pq);
+
+      rNormSqr = 0.0;
+      #pragma omp parallel for simd schedule(static) reduction(+:rNormSqr)
+      for (int i = 0; i < n; i++) {
+         mpX[i] += alpha * mpP[i];
+         mpR[i] -= alpha * mpQ[i];
+         rNormSqr += (double) mpR[i] * mpR[i];
+      }
+      if (rNormSqr <= stopSqr) {
+         break;
+      }
+
+      mpPreconditionerApply(n, mpR, mpZ);
+      double rhoNew = 0.0;
+      #pragma omp parallel for simd schedule(static) reduction(+:rhoNew)
+      for (int i = 0; i < n; i++) {
+         rhoNew += (double) mpR[i] * mpZ[i];
+      }
+      float beta = (float) (rhoNew / rho);
+      rho = rhoNew;
+
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         mpP[i] = mpZ[i] + beta * mpP[i];
+      }
+   }
+
+   return iter;
+
+}  // End of function mpInnerCG()
+
+
+
+
+
+//========================================================================
+int solvePressureMixedPrecision(double *b, double *x, double tolerance, int maxIter, double *relResidual)
+//========================================================================
+{
+   // Solves [Z]{x} = {b} by iterative refinement with single precision CG
+   // corrections. Arguments and the return value are the same as the ones
+   // of solvePressurePCG(). Returned number of iterations is the total of
+   // the inner iterations, which are limited by maxIter.
+
+   int n = Zn;
+
+   double bNormSqr = vectorDot(n, b, b);
+   if (bNormSqr == 0.0) {   // Solution is zero
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+      }
+      *relResidual = 0.0;
+      return 0;
+   }
+
+   double stopSqr = tolerance * tolerance * bNormSqr;
+   double rNormSqr;
+
+   int iter = 0;
+   while (1) {
+      // r = b - Z * x in double precision
+      zMultiplyDot(n, x, cgQ);
+      rNormSqr = 0.0;
+      #pragma omp parallel for simd schedule(static) reduction(+:rNormSqr)
+      for (int i = 0; i < n; i++) {
+         cgR[i] = b[i] - cgQ[i];
+         rNormSqr += cgR[i] * cgR[i];
+      }
+
+      if (rNormSqr <= stopSqr || iter >= maxIter) {
+         break;
+      }
+
+      // Residual is scaled to unit norm before it is rounded to float
+      double scale = sqrt(rNormSqr);
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         mpR[i] = (float) (cgR[i] / scale);
+      }
+
+      // Reduction that is needed is not smaller than what float can reach
+      double reduction = max(MIXED_INNER_REDUCTION, 0.5 * sqrt(stopSqr / rNormSqr));
+      int innerIter = mpInnerCG(n, reduction, maxIter - iter);
+      iter += max(innerIter, 1);
+
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         x[i] += scale * mpX[i];
+      }
+   }
+
+   *relResidual = sqrt(rNormSqr / bNormSqr);
+
+   if (rNormSqr > stopSqr) {
+      return -iter;
+   }
+   return iter;
+
+}  // End of function solvePressureMixedPrecision()
+
+
+
+
+
+//========================================================================
+// Sparse Cholesky factorization
+//========================================================================
+// [Z] does not change during the run, so it is factorized once, L L^T, and
+// each solve of step 2 becomes a forward and a backward triangular solve.
+// Rows are reordered by nested dissection to limit the fill-in of L. L is
+// calculated by the multifrontal method. Consecutive columns of L with the
+// same sparsity pattern form a supernode, which is stored as a dense
+// column major block whose rows are listed once. Supernodes that are not
+// ancestors of each other in the elimination tree are independent. This is
+// used to solve the supernodes of the same height in the tree in parallel.
+// A few large separators at the top of the tree are solved by all threads
+// together.
+
+static const int ND_LEAF_SIZE = 64;       // Nested dissection does not split parts smaller than this
+static const int CHOL_BLOCK_SIZE = 64;    // Column block size of the dense kernels of the supernodes
+static const int    CHOL_RELAX_SIZE = 8;       // Supernodes up to this many columns are merged regardless of the zeros
+static const double CHOL_RELAX_ZEROS = 0.05;   // Otherwise merging is allowed if at most this fraction of the stored values is zero
+
+static int     chN;
+static int    *chPerm;               // Row k of the reordered matrix is row chPerm[k] of [Z]
+static int     chNsuper;             // Number of supernodes
+static int    *chSuperStart;         // Columns of supernode s are chSuperStart[s] to chSuperStart[s+1]-1
+static int    *chChildStarts;        // Children of supernode s are chChildren[chChildStarts[s]] to chChildren[chChildStarts[s+1]-1]
+static int    *chChildren;
+static int    *chRowStarts;          // Rows of supernode s are chRows[chRowStarts[s]] to chRows[chRowStarts[s+1]-1].
+static int    *chRows;               //    Its own columns come first. Rows are in increasing order.
+static int    *chRelIndex;           // Location of each row of a supernode, that is not one of its own columns,
+                                     //    in the row list of its parent. Indexed the same way as chRows.
+static long   *chValueStarts;        // m x nColumns dense block of supernode s starts at chValue[chValueStarts[s]]
+static double *chValue;
+static long   *chUpdateStarts;       // Update vector of supernode s in the forward solve, of size m - nColumns
+static double *chUpdate;
+static TriangularSolveLevels chLevels;   // Supernodes grouped by their height in the elimination tree
+static double *chX;                  // Reordered right hand side and solution
+static double *chR;                  // Residual
+
+
+
+
+//========================================================================
+int ndLevelStructure(int root, int *nodes, int count, int *rowStarts, int *col,
+                     int *tag, int *level, int *queue, int *nLevels)
+//========================================================================
+{
+   // Breadth first search starting from root and restricted to the nodes
+   // with the same tag as root. nodes are all the nodes of the part. level of
+   // each visited node is set, others get -1. queue has the visited nodes in
+   // the order of visit. Returns the number of visited nodes.
+
+   int myTag = tag[root];
+
+   for (int k = 0; k < count; k++) {
+      level[nodes[k]] = -1;
+   }
+
+   level[root] = 0;
+   queue[0] = root;
+   int head = 0;
+   int tail = 1;
+
+   while (head < tail) {
+      int i = queue[head++];
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         int c = col[j];
+         if (tag[c] == myTag && level[c] < 0) {
+            level[c] = level[i] + 1;
+            queue[tail++] = c;
+         }
+      }
+   }
+
+   *nLevels = level[queue[tail-1]] + 1;
+   return tail;
+
+}  // End of function ndLevelStructure()
+
+
+
+
+
+//========================================================================
+bool ndGeometricBisection(int *nodes, int count, int *rowStarts, int *col, int *tag, int *half)
+//========================================================================
+{
+   // Splits a part of the graph of [Z] into two at the median coordinate in
+   // the direction of its largest extent. Nodes of the first half that are
+   // connected to the second one form the separator. nodes are reordered.
+   // half[k] of nodes[k] is 0 for the first half, 1 for the second and 2 for
+   // the separator. Returns 0 if all nodes are at the same point.
+
+   double minX[3], maxX[3];
+   for (int d = 0; d < 3; d++) {
+      minX[d] = maxX[d] = pressureCoord[nodes[0]][d];
+   }
+   for (int k = 1; k < count; k++) {
+      for (int d = 0; d < 3; d++) {
+         minX[d] = min(minX[d], pressureCoord[nodes[k]][d]);
+         maxX[d] = max(maxX[d], pressureCoord[nodes[k]][d]);
+      }
+   }
+
+   CoordinateLess less;
+   less.dir = 0;
+   for (int d = 1; d < 3; d++) {
+      if (maxX[d] - minX[d] > maxX[less.dir] - minX[less.dir]) {
+         less.dir = d;
+      }
+   }
+   if (maxX[less.dir] == minX[less.dir]) {
+      return 0;
+   }
+
+   int nA = count / 2;
+   nth_element(nodes, nodes + nA, nodes + count, less);
+
+   // Mark the second half with a tag that is not used yet
+   int myTag = tag[nodes[0]];
+   int secondTag = -2;
+   for (int k = nA; k < count; k++) {
+      tag[nodes[k]] = secondTag;
+   }
+
+   for (int k = 0; k < count; k++) {
+      half[k] = (k < nA) ? 0 : 1;
+   }
+   for (int k = 0; k < nA; k++) {
+      int i = nodes[k];
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         if (tag[col[j]] == secondTag) {
+            half[k] = 2;
+            break;
+         }
+      }
+   }
+
+   for (int k = nA; k < count; k++) {
+      tag[nodes[k]] = myTag;
+   }
+
+   return 1;
+
+}  // End of function ndGeometricBisection()
+
+
+
+
+
+//========================================================================
+bool ndLevelBisection(int *nodes, int count, int *rowStarts, int *col, int *tag,
+                      int *level, int *queue)
+//========================================================================
+{
+   // Splits a part of the graph of [Z] into two by a level of a breadth first
+   // search that starts from a pseudo-peripheral node. Used when the node
+   // coordinates are not known. On return queue[k] is the half of nodes[k],
+   // 0 for the first half, 1 for the second and 2 for the separator. If the
+   // part is not connected, the nodes that are reached and the rest form the
+   // two halves, without a separator. Returns 0 if the part is too compact
+   // to be split.
+
+   // Find a pseudo-peripheral node by repeating the search from a node of
+   // the last level with the smallest degree, as long as the number of
+   // levels increases.
+   int root = nodes[0];
+   int nLevels;
+   int nVisited = ndLevelStructure(root, nodes, count, rowStarts, col, tag, level, queue, &nLevels);
+
+   for (int trial = 0; trial < 5 && nVisited == count; trial++) {
+      int candidate = root;
+      int minDegree = -1;
+      for (int k = nVisited - 1; k >= 0 && level[queue[k]] == nLevels - 1; k--) {
+         int degree = rowStarts[queue[k] + 1] - rowStarts[queue[k]];
+         if (minDegree < 0 || degree < minDegree) {
+            minDegree = degree;
+            candidate = queue[k];
+         }
+      }
+
+      int candidateLevels;
+      ndLevelStructure(candidate, nodes, count, rowStarts, col, tag, level, queue, &candidateLevels);
+      root = candidate;
+      if (candidateLevels <= nLevels) {
+         break;
+      }
+      nLevels = candidateLevels;
+   }
+
+   if (nVisited < count) {
+      for (int k = 0; k < count; k++) {
+         queue[k] = (level[nodes[k]] >= 0) ? 0 : 1;
+      }
+      return 1;
+   }
+
+   if (nLevels < 3) {
+      return 0;
+   }
+
+   // Separator is the level of the middle node of the search. Nodes of that
+   // level that are not connected to the next level are moved to the first
+   // half, which makes the separator thinner.
+   int myTag = tag[nodes[0]];
+   int sepLevel = level[queue[count / 2]];
+   sepLevel = max(1, min(nLevels - 2, sepLevel));
+
+   for (int k = 0; k < count; k++) {
+      int i = nodes[k];
+      if (level[i] < sepLevel) {
+         queue[k] = 0;
+      } else if (level[i] > sepLevel) {
+         queue[k] = 1;
+      } else {
+         queue[k] = 0;
+         for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+            if (tag[col[j]] == myTag && level[col[j]] == sepLevel + 1) {
+               queue[k] = 2;
+               break;
+            }
+         }
+      }
+   }
+
+   return 1;
+
+}  // End of function ndLevelBisection()
+
+
+
+
+
+//========================================================================
+void ndDissect(int *nodes, int count, int *rowStarts, int *col, int *tag, int &nextTag,
+               int *level, int *queue, int *perm, int &position)
+//========================================================================
+{
+   // Orders the nodes of a part of the graph of [Z] by nested dissection.
+   // All nodes of the part have the same tag. They take the positions of
+   // perm that end at position, which is then moved to the first of them.
+   // The part is split into two halves and a separator, which is ordered
+   // after the halves. Halves are dissected recursively. Small parts are
+   // kept in their original order.
+
+   bool split = 0;
+   if (count > ND_LEAF_SIZE) {
+      if (pressureCoord != NULL) {
+         split = ndGeometricBisection(nodes, count, rowStarts, col, tag, queue);
+      } else {
+         split = ndLevelBisection(nodes, count, rowStarts, col, tag, level, queue);
+      }
+   }
+
+   if (!split) {
+      sort(nodes, nodes + count);
+      position -= count;
+      for (int k = 0; k < count; k++) {
+         perm[position + k] = nodes[k];
+      }
+      return;
+   }
+
+   // queue[k] is the half of nodes[k]
+   int tagA = nextTag++;
+   int tagB = nextTag++;
+   int nA = 0;
+   int nB = 0;
+   int nS = 0;
+
+   for (int k = 0; k < count; k++) {
+      if (queue[k] == 0) {
+         tag[nodes[k]] = tagA;
+         nA++;
+      } else if (queue[k] == 1) {
+         tag[nodes[k]] = tagB;
+         nB++;
+      } else {
+         tag[nodes[k]] = -1;
+         nS++;
+      }
+   }
+
+   // Separator takes the last positions. Nodes of the halves are moved to
+   // the beginning of nodes, first half first.
+   position -= nS;
+   int s = position;
+   int a = 0;
+   for (int k = 0; k < count; k++) {
+      if (tag[nodes[k]] == -1) {
+         perm[s++] = nodes[k];
+      } else if (tag[nodes[k]] == tagA) {
+         queue[a++] = nodes[k];
+      }
+   }
+   for (int k = 0; k < count; k++) {
+      if (tag[nodes[k]] == tagB) {
+         queue[a++] = nodes[k];
+      }
+   }
+   sort(perm + position, perm + position + nS);
+   for (int k = 0; k < nA + nB; k++) {
+      nodes[k] = queue[k];
+   }
+
+   ndDissect(nodes + nA, nB, rowStarts, col, tag, nextTag, level, queue, perm, position);
+   ndDissect(nodes, nA, rowStarts, col, tag, nextTag, level, queue, perm, position);
+
+}  // End of function ndDissect()
+
+
+
+
+
+//========================================================================
+void nestedDissectionOrder(int n, int *rowStarts, int *col, int *perm)
+//========================================================================
+{
+   // Calculates the nested dissection ordering of a symmetric matrix.
+   // perm[k] is the original index of the k-th row of the reordered matrix.
+
+   int *nodes = new int[n];
+   int *tag   = new int[n];
+   int *level = new int[n];
+   int *queue = new int[n];
+
+   for (int i = 0; i < n; i++) {
+      nodes[i] = i;
+      tag[i]   = 0;
+   }
+
+   int nextTag = 1;
+   int position = n;
+   ndDissect(nodes, n, rowStarts, col, tag, nextTag, level, queue, perm, position);
+
+   delete[] nodes;
+   delete[] tag;
+   delete[] level;
+   delete[] queue;
+
+}  // End of function nestedDissectionOrder()
+
+
+
+
+
+//========================================================================
+void reorderMatrix(int n, int *rowStarts, int *col, double *value, int *perm, CSRmatrix &B)
+//========================================================================
+{
+   // B = P A P^T, where row k of B is row perm[k] of A. Columns of the rows
+   // of B are sorted.
+
+   int *invPerm = new int[n];
+   for (int k = 0; k < n; k++) {
+      invPerm[perm[k]] = k;
+   }
+
+   B.rowStarts[0] = 0;
+   for (int k = 0; k < n; k++) {
+      int i = perm[k];
+      int start = B.rowStarts[k];
+      int counter = start;
+      for (int j = rowStarts[i]; j < rowStarts[i+1]; j++) {
+         B.col[counter]   = invPerm[col[j]];
+         B.value[counter] = value[j];
+         counter++;
+      }
+      B.rowStarts[k+1] = counter;
+      csrSortRow(B.col + start, B.value + start, counter - start);
+   }
+
+   delete[] invPerm;
+
+}  // End of function reorderMatrix()
+
+
+
+
+
+//========================================================================
+void eliminationTree(CSRmatrix &A, int *parent, int *ancestor)
+//========================================================================
+{
+   // Elimination tree of a symmetric matrix with sorted rows, by Liu's
+   // algorithm with path compression. Roots have a parent of -1.
+
+   for (int k = 0; k < A.nRows; k++) {
+      parent[k]   = -1;
+      ancestor[k] = -1;
+      for (int j = A.rowStarts[k]; j < A.rowStarts[k+1] && A.col[j] < k; j++) {
+         int i = A.col[j];
+         while (i != -1 && i < k) {
+            int next = ancestor[i];
+            ancestor[i] = k;
+            if (next == -1) {
+               parent[i] = k;
+            }
+            i = next;
+         }
+      }
+   }
+
+}  // End of function eliminationTree()
+
+
+
+
+
+//========================================================================
+void treePostorder(int n, int *parent, int *post)
+//========================================================================
+{
+   // post[k] is the k-th node of a depth first postorder of the forest
+   // defined by parent. Children are visited in increasing order.
+
+   int *head  = new int[n];
+   int *next  = new int[n];
+   int *stack = new int[n];
+
+   for (int i = 0; i < n; i++) {
+      head[i] = -1;
+   }
+   for (int i = n - 1; i >= 0; i--) {
+      if (parent[i] != -1) {
+         next[i] = head[parent[i]];
+         head[parent[i]] = i;
+      }
+   }
+
+   int k = 0;
+   for (int root = 0; root < n; root++) {
+      if (parent[root] != -1) {
+         continue;
+      }
+      int top = 0;
+      stack[0] = root;
+      while (top >= 0) {
+         int p = stack[top];
+         int child = head[p];
+         if (child == -1) {
+            top--;
+            post[k++] = p;
+         } else {
+            head[p] = next[child];
+            stack[++top] = child;
+         }
+      }
+   }
+
+   delete[] head;
+   delete[] next;
+   delete[] stack;
+
+}  // End of function treePostorder()
+
+
+
+
+
+//========================================================================
+bool denseFrontFactorize(double *F, int m, int nc)
+//========================================================================
+{
+   // Partial Cholesky factorization of the first nc columns of the m x m
+   // frontal matrix F, of which only the lower triangle is used. F is column
+   // major. On return the first nc columns are columns of L and the trailing
+   // (m-nc) x (m-nc) block is the update matrix that is passed to the parent.
+   // Columns are processed in blocks. Update of the trailing columns by a
+   // block, which is most of the work, is done in parallel. Returns 0 if a
+   // pivot is not positive.
+
+   for (int kb = 0; kb < nc; kb += CHOL_BLOCK_SIZE) {
+      int ke = min(kb + CHOL_BLOCK_SIZE, nc);
+
+      // Factorize the columns of the block
+      for (int k = kb; k < ke; k++) {
+         double *Fk = &F[(long)k * m];
+         if (Fk[k] <= 0.0) {
+            return 0;
+         }
+         double d = sqrt(Fk[k]);
+         Fk[k] = d;
+         for (int i = k + 1; i < m; i++) {
+            Fk[i] /= d;
+         }
+         for (int j = k + 1; j < ke; j++) {
+            double *Fj = &F[(long)j * m];
+            double Fjk = Fk[j];
+            for (int i = j; i < m; i++) {
+               Fj[i] -= Fjk * Fk[i];
+            }
+         }
+      }
+
+      // Update the trailing columns with the block
+      #pragma omp parallel for schedule(dynamic, 8)
+      for (int j = ke; j < m; j++) {
+         double *Fj = &F[(long)j * m];
+         for (int k = kb; k < ke; k++) {
+            double *Fk = &F[(long)k * m];
+            double Fjk = Fk[j];
+            if (Fjk != 0.0) {
+               for (int i = j; i < m; i++) {
+                  Fj[i] -= Fjk * Fk[i];
+               }
+            }
+         }
+      }
+   }
+
+   return 1;
+
+}  // End of function denseFrontFactorize()
+
+
+
+
+
+//========================================================================
+bool setupPressureCholesky(int n, int *rowStarts, int *col, double *value, double **nodeCoord)
+//========================================================================
+{
+   // Calculates the sparse Cholesky factorization of [Z] and everything
+   // that solvePressureCholesky() needs. nodeCoord are the coordinates of the
+   // pressure nodes, which are used by the nested dissection. If they are
+   // NULL, a graph based nested dissection is used. Returns 0 if the
+   // factorization fails, which can happen only if [Z] is not positive
+   // definite.
+
+   double Start = omp_get_wtime();
+
+   pressureCoord = nodeCoord;
+   Zn         = n;
+   ZrowStarts = rowStarts;
+   Zcol       = col;
+   Zvalue     = value;
+   chN        = n;
+
+   // Ordering. Nested dissection is followed by a postorder of the
+   // elimination tree, which does not change the fill-in but makes the
+   // columns of each supernode consecutive.
+   int *ndPerm   = new int[n];
+   int *parent   = new int[n];
+   int *work     = new int[n];
+   int *post     = new int[n];
+   CSRmatrix A = csrAllocate(n, n, rowStarts[n]);
+
+   nestedDissectionOrder(n, rowStarts, col, ndPerm);
+   reorderMatrix(n, rowStarts, col, value, ndPerm, A);
+   eliminationTree(A, parent, work);
+   treePostorder(n, parent, post);
+
+   chPerm = new int[n];
+   for (int k = 0; k < n; k++) {
+      chPerm[k] = ndPerm[post[k]];
+   }
+   reorderMatrix(n, rowStarts, col, value, chPerm, A);
+   eliminationTree(A, parent, work);
+
+   delete[] ndPerm;
+   delete[] post;
+
+   // Number of nonzeros of each column of L, by traversing the row subtrees
+   // of the elimination tree. Row i of L has nonzeros on the paths from each
+   // k < i with A(i,k) != 0 up to i.
+   int *colCount  = new int[n];
+   int *nChildren = new int[n];
+   int *mark      = work;
+
+   for (int j = 0; j < n; j++) {
+      colCount[j]  = 1;
+      nChildren[j] = 0;
+   }
+   for (int j = 0; j < n; j++) {
+      if (parent[j] != -1) {
+         nChildren[parent[j]]++;
+      }
+   }
+   for (int i = 0; i < n; i++) {
+      mark[i] = i;
+      for (int j = A.rowStarts[i]; j < A.rowStarts[i+1] && A.col[j] < i; j++) {
+         for (int k = A.col[j]; mark[k] != i; k = parent[k]) {
+            colCount[k]++;
+            mark[k] = i;
+         }
+      }
+   }
+
+   // Supernodes. Column j joins the supernode of column j-1 if it is the
+   // parent of j-1 and either the pattern of j-1 is that of j plus j-1
+   // (fundamental supernode), or the supernode stays small or has few
+   // stored zeros (relaxed supernode). Columns of a supernode form a chain
+   // in the elimination tree, so its rows are its own columns and the rows
+   // of its last column.
+   int *superOf = new int[n];
+   chSuperStart = new int[n + 1];
+   chNsuper = 0;
+   long superNonzeros = 0;   // Nonzeros of L in the current supernode
+   for (int j = 0; j < n; j++) {
+      bool join = 0;
+      if (j > 0 && parent[j-1] == j) {
+         int first = chSuperStart[chNsuper - 1];
+         long nc = j - first + 1;
+         long m  = (j - first) + colCount[j];
+         long stored = nc * m - nc * (nc - 1) / 2;
+         long zeros  = stored - (superNonzeros + colCount[j]);
+         join = (nChildren[j] == 1 && colCount[j-1] == colCount[j] + 1 && zeros == 0) ||
+                nc <= CHOL_RELAX_SIZE || zeros <= CHOL_RELAX_ZEROS * stored;
+      }
+      if (!join) {
+         chSuperStart[chNsuper++] = j;
+         superNonzeros = 0;
+      }
+      superNonzeros += colCount[j];
+      superOf[j] = chNsuper - 1;
+   }
+   chSuperStart[chNsuper] = n;
+
+   int *superParent = new int[chNsuper];
+   chChildStarts = new int[chNsuper + 1];
+   chChildren    = new int[chNsuper];
+   int *childStarts = chChildStarts;
+   int *children    = chChildren;
+
+   for (int s = 0; s <= chNsuper; s++) {
+      childStarts[s] = 0;
+   }
+   for (int s = 0; s < chNsuper; s++) {
+      int p = parent[chSuperStart[s+1] - 1];
+      superParent[s] = (p == -1) ? -1 : superOf[p];
+      if (p != -1) {
+         childStarts[superParent[s] + 1]++;
+      }
+   }
+   for (int s = 0; s < chNsuper; s++) {
+      childStarts[s+1] += childStarts[s];
+   }
+   for (int s = 0; s < chNsuper; s++) {   // Children are listed in increasing order
+      if (superParent[s] != -1) {
+         children[childStarts[superParent[s]]++] = s;
+      }
+   }
+   for (int s = chNsuper; s > 0; s--) {
+      childStarts[s] = childStarts[s-1];
+   }
+   childStarts[0] = 0;
+
+   // Row lists of the supernodes. Rows of a supernode are its own columns,
+   // rows of [Z] below them and rows of its children that are below them.
+   chRowStarts    = new int[chNsuper + 1];
+   chValueStarts  = new long[chNsuper + 1];
+   chUpdateStarts = new long[chNsuper + 1];
+   chRowStarts[0]    = 0;
+   chValueStarts[0]  = 0;
+   chUpdateStarts[0] = 0;
+   int maxM = 0;
+   for (int s = 0; s < chNsuper; s++) {
+      int nc = chSuperStart[s+1] - chSuperStart[s];
+      int m = nc - 1 + colCount[chSuperStart[s+1] - 1];
+      chRowStarts[s+1]    = chRowStarts[s] + m;
+      chValueStarts[s+1]  = chValueStarts[s] + (long)m * nc;
+      chUpdateStarts[s+1] = chUpdateStarts[s] + (m - nc);
+      maxM = max(maxM, m);
+   }
+
+   chRows     = new int[chRowStarts[chNsuper]];
+   chRelIndex = new int[chRowStarts[chNsuper]];
+
+   for (int i = 0; i < n; i++) {
+      mark[i] = -1;
+   }
+
+   bool success = 1;
+
+   for (int s = 0; s < chNsuper && success; s++) {
+      int first = chSuperStart[s];
+      int last  = chSuperStart[s+1] - 1;
+      int *rows = &chRows[chRowStarts[s]];
+      int m = 0;
+
+      for (int j = first; j <= last; j++) {
+         rows[m++] = j;
+         mark[j] = s;
+      }
+      for (int j = first; j <= last; j++) {
+         for (int k = A.rowStarts[j]; k < A.rowStarts[j+1]; k++) {
+            int i = A.col[k];
+            if (i > last && mark[i] != s) {
+               rows[m++] = i;
+               mark[i] = s;
+            }
+         }
+      }
+      for (int c = childStarts[s]; c < childStarts[s+1]; c++) {
+         int child = children[c];
+         int childColumns = chSuperStart[child+1] - chSuperStart[child];
+         for (int k = chRowStarts[child] + childColumns; k < chRowStarts[child+1]; k++) {
+            int i = chRows[k];
+            if (i > last && mark[i] != s) {
+               rows[m++] = i;
+               mark[i] = s;
+            }
+         }
+      }
+
+      if (m != chRowStarts[s+1] - chRowStarts[s]) {
+         printf("ERROR: Symbolic factorization of [Z] found %d rows instead of %d for a supernode.\n",
+                m, chRowStarts[s+1] - chRowStarts[s]);
+         success = 0;
+      }
+      sort(rows + (last - first + 1), rows + m);
+   }
+
+   // Locations of the rows of each supernode in the row list of its parent
+   int *position = work;
+   for (int s = 0; s < chNsuper && success; s++) {
+      for (int k = chRowStarts[s]; k < chRowStarts[s+1]; k++) {
+         position[chRows[k]] = k - chRowStarts[s];
+      }
+      for (int c = childStarts[s]; c < childStarts[s+1]; c++) {
+         int child = children[c];
+         int childColumns = chSuperStart[child+1] - chSuperStart[child];
+         for (int k = chRowStarts[child] + childColumns; k < chRowStarts[child+1]; k++) {
+            chRelIndex[k] = position[chRows[k]];
+         }
+      }
+   }
+
+   // Numerical factorization by the multifrontal method. Supernodes are
+   // processed in increasing order, so that children come before their
+   // parent. Frontal matrix of a supernode is assembled from the entries
+   // of [Z] in its columns and the update matrices of its children.
+   chValue = new double[chValueStarts[chNsuper]];
+   double *front = new double[(long)maxM * maxM];
+   double **updateMatrix = new double*[chNsuper];
+
+   for (int s = 0; s < chNsuper && success; s++) {
+      int first = chSuperStart[s];
+      int nc = chSuperStart[s+1] - first;
+      int m = chRowStarts[s+1] - chRowStarts[s];
+      int *rows = &chRows[chRowStarts[s]];
+
+      #pragma omp parallel for schedule(static)
+      for (int j = 0; j < m; j++) {
+         for (int i = j; i < m; i++) {
+            front[i + (long)j * m] = 0.0;
+         }
+      }
+
+      for (int k = 0; k < m; k++) {
+         position[rows[k]] = k;
+      }
+      for (int j = 0; j < nc; j++) {
+         for (int k = A.rowStarts[first + j]; k < A.rowStarts[first + j + 1]; k++) {
+            if (A.col[k] >= first + j) {
+               front[position[A.col[k]] + (long)j * m] += A.value[k];
+            }
+         }
+      }
+
+      for (int c = childStarts[s]; c < childStarts[s+1]; c++) {
+         int child = children[c];
+         int childColumns = chSuperStart[child+1] - chSuperStart[child];
+         int mc = chRowStarts[child+1] - chRowStarts[child] - childColumns;
+         int *rel = &chRelIndex[chRowStarts[child] + childColumns];
+         double *U = updateMatrix[child];
+
+         #pragma omp parallel for schedule(dynamic, 8)
+         for (int b = 0; b < mc; b++) {
+            double *Fb = &front[(long)rel[b] * m];
+            for (int a = b; a < mc; a++) {
+               Fb[rel[a]] += U[a + (long)b * mc];
+            }
+         }
+         delete[] U;
+      }
+
+      if (!denseFrontFactorize(front, m, nc)) {
+         printf("ERROR: Sparse Cholesky factorization of [Z] found a non-positive pivot.\n");
+         success = 0;
+         break;
+      }
+
+      double *L = &chValue[chValueStarts[s]];
+      for (long k = 0; k < (long)m * nc; k++) {
+         L[k] = front[k];
+      }
+
+      int mu = m - nc;
+      if (mu > 0) {
+         double *U = new double[(long)mu * mu];
+         #pragma omp parallel for schedule(static)
+         for (int b = 0; b < mu; b++) {
+            for (int a = b; a < mu; a++) {
+               U[a + (long)b * mu] = front[(nc + a) + (long)(nc + b) * m];
+            }
+         }
+         updateMatrix[s] = U;
+      }
+   }
+
+   // Levels of the triangular solves. Height of a supernode is one more than
+   // the largest height of its children.
+   int *height = work;
+   for (int s = 0; s < chNsuper; s++) {
+      height[s] = 0;
+   }
+   int maxHeight = 0;
+   for (int s = 0; s < chNsuper; s++) {
+      if (superParent[s] != -1) {
+         height[superParent[s]] = max(height[superParent[s]], height[s] + 1);
+      }
+      maxHeight = max(maxHeight, height[s]);
+   }
+
+   chLevels.nLevels = maxHeight + 1;
+   chLevels.levelStarts = new int[chLevels.nLevels + 1];
+   chLevels.rows = new int[chNsuper];
+   for (int l = 0; l <= chLevels.nLevels; l++) {
+      chLevels.levelStarts[l] = 0;
+   }
+   for (int s = 0; s < chNsuper; s++) {
+      chLevels.levelStarts[height[s] + 1]++;
+   }
+   for (int l = 0; l < chLevels.nLevels; l++) {
+      chLevels.levelStarts[l+1] += chLevels.levelStarts[l];
+   }
+   int *levelFill = new int[chLevels.nLevels];
+   for (int l = 0; l < chLevels.nLevels; l++) {
+      levelFill[l] = chLevels.levelStarts[l];
+   }
+   for (int s = 0; s < chNsuper; s++) {
+      chLevels.rows[levelFill[height[s]]++] = s;
+   }
+   delete[] levelFill;
+
+   chUpdate = new double[chUpdateStarts[chNsuper] + 1];
+   chX = new double[n];
+   chR = new double[n];
+
+   long nnzL = chValueStarts[chNsuper];   // Including the unused upper triangles of the diagonal blocks
+   long nnzLowerZ = (rowStarts[n] + n) / 2;
+
+   delete[] front;
+   delete[] updateMatrix;
+   delete[] parent;
+   delete[] work;
+   delete[] colCount;
+   delete[] nChildren;
+   delete[] superOf;
+   delete[] superParent;
+   csrFree(A);
+
+   if (!success) {
+      return 0;
+   }
+
+   printf("Sparse Cholesky factor of [Z] has %d supernodes in %d levels and %ld values (%.1f times the lower triangle of [Z]). It took %.3f seconds.\n",
+          chNsuper, chLevels.nLevels, nnzL, (double)nnzL / nnzLowerZ, omp_get_wtime() - Start);
+
+   return 1;
+
+}  // End of function setupPressureCholesky()
+
+
+
+
+
+//========================================================================
+void chForwardAssemble(int s)
+//========================================================================
+{
+   // First part of the forward solve of supernode s. Update vectors of its
+   // children are added to its own entries of chX and to its update vector.
+
+   int first = chSuperStart[s];
+   int nc = chSuperStart[s+1] - first;
+   int m = chRowStarts[s+1] - chRowStarts[s];
+   double *x = &chX[first];
+   double *u = &chUpdate[chUpdateStarts[s]];
+
+   for (int i = 0; i < m - nc; i++) {
+      u[i] = 0.0;
+   }
+
+   for (int c = chChildStarts[s]; c < chChildStarts[s+1]; c++) {
+      int child = chChildren[c];
+      int childStart = chRowStarts[child] + chSuperStart[child+1] - chSuperStart[child];
+      double *uc = &chUpdate[chUpdateStarts[child]];
+      for (int k = childStart; k < chRowStarts[child+1]; k++) {
+         int p = chRelIndex[k];
+         if (p < nc) {
+            x[p] += uc[k - childStart];
+         } else {
+            u[p - nc] += uc[k - childStart];
+         }
+      }
+   }
+
+}  // End of function chForwardAssemble()
+
+
+
+
+
+//========================================================================
+void chForwardDiagonal(int s, int kb, int ke)
+//========================================================================
+{
+   // Forward solve with the diagonal block of columns kb to ke-1 of
+   // supernode s.
+
+   int m = chRowStarts[s+1] - chRowStarts[s];
+   double *L = &chValue[chValueStarts[s]];
+   double *x = &chX[chSuperStart[s]];
+
+   for (int k = kb; k < ke; k++) {
+      double *Lk = &L[(long)k * m];
+      x[k] /= Lk[k];
+      for (int i = k + 1; i < ke; i++) {
+         x[i] -= Lk[i] * x[k];
+      }
+   }
+
+}  // End of function chForwardDiagonal()
+
+
+
+
+
+//========================================================================
+void chForwardRows(int s, int kb, int ke, int iBegin, int iEnd)
+//========================================================================
+{
+   // Subtracts the contribution of the solved columns kb to ke-1 of
+   // supernode s from rows iBegin to iEnd-1 of it, which are below these
+   // columns. Rows of its own columns are in chX, others are in its update
+   // vector.
+
+   int first = chSuperStart[s];
+   int nc = chSuperStart[s+1] - first;
+   int m = chRowStarts[s+1] - chRowStarts[s];
+   double *L = &chValue[chValueStarts[s]];
+   double *x = &chX[first];
+   double *u = &chUpdate[chUpdateStarts[s]] - nc;   // u[i] is row i, for i >= nc
+
+   for (int k = kb; k < ke; k++) {
+      double *Lk = &L[(long)k * m];
+      double xk = x[k];
+      int i = iBegin;
+      for (; i < min(iEnd, nc); i++) {
+         x[i] -= Lk[i] * xk;
+      }
+      for (; i < iEnd; i++) {
+         u[i] -= Lk[i] * xk;
+      }
+   }
+
+}  // End of function chForwardRows()
+
+
+
+
+
+//========================================================================
+void chBackwardColumns(int s, int kb, int ke, int iBegin)
+//========================================================================
+{
+   // Subtracts L(i,k) * x(i) for rows i >= iBegin of supernode s from the
+   // entries k = kb to ke-1 of the solution. Rows that are not its own
+   // columns belong to its ancestors, which are already solved.
+
+   int first = chSuperStart[s];
+   int m = chRowStarts[s+1] - chRowStarts[s];
+   int *rows = &chRows[chRowStarts[s]];
+   double *L = &chValue[chValueStarts[s]];
+
+   for (int k = kb; k < ke; k++) {
+      double *Lk = &L[(long)k * m];
+      double sum = 0.0;
+      for (int i = iBegin; i < m; i++) {
+         sum += Lk[i] * chX[rows[i]];
+      }
+      chX[first + k] -= sum;
+   }
+
+}  // End of function chBackwardColumns()
+
+
+
+
+
+//========================================================================
+void chBackwardDiagonal(int s, int kb, int ke)
+//========================================================================
+{
+   // Backward solve with the transpose of the diagonal block of columns kb
+   // to ke-1 of supernode s.
+
+   int m = chRowStarts[s+1] - chRowStarts[s];
+   double *L = &chValue[chValueStarts[s]];
+   double *x = &chX[chSuperStart[s]];
+
+   for (int k = ke - 1; k >= kb; k--) {
+      double *Lk = &L[(long)k * m];
+      double sum = x[k];
+      for (int i = k + 1; i < ke; i++) {
+         sum -= Lk[i] * x[i];
+      }
+      x[k] = sum / Lk[k];
+   }
+
+}  // End of function chBackwardDiagonal()
+
+
+
+
+
+//========================================================================
+void chSolveSupernode(int s, bool forward)
+//========================================================================
+{
+   // Forward or backward solve of supernode s by a single thread.
+
+   int nc = chSuperStart[s+1] - chSuperStart[s];
+   int m = chRowStarts[s+1] - chRowStarts[s];
+
+   if (forward) {
+      chForwardAssemble(s);
+      for (int kb = 0; kb < nc; kb += CHOL_BLOCK_SIZE) {
+         int ke = min(kb + CHOL_BLOCK_SIZE, nc);
+         chForwardDiagonal(s, kb, ke);
+         chForwardRows(s, kb, ke, ke, m);
+      }
+   } else {
+      for (int kb = ((nc - 1) / CHOL_BLOCK_SIZE) * CHOL_BLOCK_SIZE; kb >= 0; kb -= CHOL_BLOCK_SIZE) {
+         int ke = min(kb + CHOL_BLOCK_SIZE, nc);
+         chBackwardColumns(s, kb, ke, ke);
+         chBackwardDiagonal(s, kb, ke);
+      }
+   }
+
+}  // End of function chSolveSupernode()
+
+
+
+
+
+//========================================================================
+void chSolveSupernodeShared(int s, bool forward)
+//========================================================================
+{
+   // Forward or backward solve of supernode s by all threads of the
+   // enclosing parallel region. Used for the large separators at the top of
+   // the elimination tree. Diagonal blocks are solved by a single thread,
+   // the rows below them are shared.
+
+   int nc = chSuperStart[s+1] - chSuperStart[s];
+   int m = chRowStarts[s+1] - chRowStarts[s];
+
+   if (forward) {
+      #pragma omp single
+      chForwardAssemble(s);
+
+      for (int kb = 0; kb < nc; kb += CHOL_BLOCK_SIZE) {
+         int ke = min(kb + CHOL_BLOCK_SIZE, nc);
+
+         #pragma omp single
+         chForwardDiagonal(s, kb, ke);
+
+         int nChunks = (m - ke + CHOL_BLOCK_SIZE - 1) / CHOL_BLOCK_SIZE;
+         #pragma omp for schedule(static)
+         for (int c = 0; c < nChunks; c++) {
+            int iBegin = ke + c * CHOL_BLOCK_SIZE;
+            chForwardRows(s, kb, ke, iBegin, min(iBegin + CHOL_BLOCK_SIZE, m));
+         }
+      }
+   } else {
+      for (int kb = ((nc - 1) / CHOL_BLOCK_SIZE) * CHOL_BLOCK_SIZE; kb >= 0; kb -= CHOL_BLOCK_SIZE) {
+         int ke = min(kb + CHOL_BLOCK_SIZE, nc);
+
+         #pragma omp for schedule(static)
+         for (int k = kb; k < ke; k++) {
+            chBackwardColumns(s, k, k + 1, ke);
+         }
+
+         #pragma omp single
+         chBackwardDiagonal(s, kb, ke);
+      }
+   }
+
+}  // End of function chSolveSupernodeShared()
+
+
+
+
+
+//========================================================================
+void solvePressureCholesky(double *b, double *x, double *relResidual)
+//========================================================================
+{
+   // Solves [Z]{x} = {b} with the factor of setupPressureCholesky(). Levels
+   // of supernodes are processed from the leaves up in the forward solve and
+   // from the root down in the backward solve. Supernodes of a level are
+   // shared among the threads. If a level has fewer supernodes than threads,
+   // each of them is solved by all threads together. Also returns the
+   // relative residual ||b - Z x|| / ||b||.
+
+   int n = chN;
+
+   #pragma omp parallel
+   {
+      int nThreads = omp_get_num_threads();
+
+      #pragma omp for schedule(static)
+      for (int k = 0; k < n; k++) {
+         chX[k] = b[chPerm[k]];
+      }
+
+      for (int l = 0; l < chLevels.nLevels; l++) {
+         int levelFirst = chLevels.levelStarts[l];
+         int levelLast  = chLevels.levelStarts[l+1];
+         if (levelLast - levelFirst >= nThreads) {
+            #pragma omp for schedule(dynamic)
+            for (int k = levelFirst; k < levelLast; k++) {
+               chSolveSupernode(chLevels.rows[k], 1);
+            }
+         } else {
+            for (int k = levelFirst; k < levelLast; k++) {
+               chSolveSupernodeShared(chLevels.rows[k], 1);
+            }
+         }
+      }
+
+      for (int l = chLevels.nLevels - 1; l >= 0; l--) {
+         int levelFirst = chLevels.levelStarts[l];
+         int levelLast  = chLevels.levelStarts[l+1];
+         if (levelLast - levelFirst >= nThreads) {
+            #pragma omp for schedule(dynamic)
+            for (int k = levelFirst; k < levelLast; k++) {
+               chSolveSupernode(chLevels.rows[k], 0);
+            }
+         } else {
+            for (int k = levelFirst; k < levelLast; k++) {
+               chSolveSupernodeShared(chLevels.rows[k], 0);
+            }
+         }
+      }
+
+      #pragma omp for schedule(static)
+      for (int k = 0; k < n; k++) {
+         x[chPerm[k]] = chX[k];
+      }
+   }
+
+   // r = b - Z * x
+   zMultiplyDot(n, x, chR);
+   double rNormSqr = 0.0;
+   double bNormSqr = 0.0;
+   #pragma omp parallel for simd schedule(static) reduction(+:rNormSqr,bNormSqr)
+   for (int i = 0; i < n; i++) {
+      double r = b[i] - chR[i];
+      rNormSqr += r * r;
+      bNormSqr += b[i] * b[i];
+   }
+
+   *relResidual = (bNormSqr == 0.0) ? 0.0 : sqrt(rNormSqr / bNormSqr);
+
+}  // End of function solvePressureCholesky()
+
+
+
+
+
+//========================================================================
+// Initial guess from previous solutions
+//========================================================================
+// Right hand side of the pressure system changes only slightly between the
+// inner iterations and the time steps, so previous solutions make a good
+// initial guess. With projection, which is Fischer's method, previous
+// solutions span a space with a basis x_k that is kept Z-orthonormal. Best
+// approximation to the new solution in that space, in the Z-norm, is
+// sum (x_k . b) x_k, which needs no multiplication with [Z]. After each
+// solve, the solution is Z-orthogonalized against the basis and added to
+// it. When the window is full the basis restarts with the latest solution.
+
+static int      guessMethod;        // 0: zero, 1: previous solution, 2: projection
+static int      guessWindow;        // Max. number of basis vectors of the projection
+static int      guessN;             // Number of basis vectors, or previous solutions, that are stored
+static double **guessX;             // Basis vectors x_k. guessX[0] is the previous solution for method 1.
+static double **guessZX;            // Z * x_k
+static double  *guessCoeff;         // x_k . b
+
+
+
+
+//========================================================================
+bool setupPressureInitialGuess(int n, int *rowStarts, int *col, double *value, int method, int window)
+//========================================================================
+{
+   // Keeps a reference to [Z] and allocates the stored solutions. Used by
+   // all pressure solvers, including MKL's CG, so it does not depend on
+   // setupPressureSolver(). Returns 0 if the method number is not valid.
+
+   if (method < 0 || method > 2) {
+      printf("ERROR: Unknown initial guess method %d of the pressure solvers.\n", method);
+      return 0;
+   }
+
+   Zn         = n;
+   ZrowStarts = rowStarts;
+   Zcol       = col;
+   Zvalue     = value;
+
+   guessMethod = method;
+   guessWindow = (method == 2) ? max(window, 1) : 1;
+   guessN      = 0;
+
+   if (method == 0) {
+      return 1;
+   }
+
+   guessX     = new double*[guessWindow];
+   guessZX    = new double*[guessWindow];
+   guessCoeff = new double[guessWindow];
+   for (int k = 0; k < guessWindow; k++) {
+      guessX[k]  = new double[n];
+      guessZX[k] = (method == 2) ? new double[n] : NULL;
+   }
+
+   return 1;
+
+}  // End of function setupPressureInitialGuess()
+
+
+
+
+
+//========================================================================
+void initialPressureGuess(double *b, double *x)
+//========================================================================
+{
+   // Calculates the initial guess x of the solution of [Z]{x} = {b}.
+
+   int n = Zn;
+
+   if (guessN == 0) {
+      for (int i = 0; i < n; i++) {
+         x[i] = 0.0;
+      }
+   } else if (guessMethod == 1) {
+      vectorCopy(n, guessX[0], x);
+   } else {
+      for (int k = 0; k < guessN; k++) {
+         guessCoeff[k] = vectorDot(n, guessX[k], b);
+      }
+      #pragma omp parallel for schedule(static)
+      for (int i = 0; i < n; i++) {
+         double sum = 0.0;
+         for (int k = 0; k < guessN; k++) {
+            sum += guessCoeff[k] * guessX[k][i];
+         }
+         x[i] = sum;
+      }
+   }
+
+}  // End of function initialPressureGuess()
+
+
+
+
+
+//========================================================================
+void savePressureSolution(double *x)
+//========================================================================
+{
+   // Stores the solution x of a pressure solve for the following initial
+   // guesses.
+
+   int n = Zn;
+
+   if (guessMethod == 0) {
+      return;
+   }
+
+   if (guessMethod == 1) {
+      vectorCopy(n, x, guessX[0]);
+      guessN = 1;
+      return;
+   }
+
+   if (guessN == guessWindow) {   // Restart the basis
+      guessN = 0;
+   }
+
+   // New basis vector t = x - sum (Z x_k . t) x_k, by modified Gram-Schmidt,
+   // and Z t, which is updated the same way.
+   double *t  = guessX[guessN];
+   double *Zt = guessZX[guessN];
+   vectorCopy(n, x, t);
+   double xZx = zMultiplyDot(n, t, Zt);
+
+   for (int k = 0; k < guessN; k++) {
+      double alpha = vectorDot(n, guessZX[k], t);
+      #pragma omp parallel for simd schedule(static)
+      for (int i = 0; i < n; i++) {
+         t[i]  -= alpha * guessX[k][i];
+         Zt[i] -= alpha * guessZX[k][i];
+      }
+   }
+
+   double tZt = vectorDot(n, t, Zt);
+   if (tZt <= 1e-20 * xZx) {   // x is already in the space of the basis, or is zero
+      return;
+   }
+
+   double scale = 1.0 / sqrt(tZt);
+   #pragma omp parallel for simd schedule(static)
+   for (int i = 0; i < n; i++) {
+      t[i]  *= scale;
+      Zt[i] *= scale;
+   }
+   guessN++;
+
+}  // End of function savePressureSolution()